@@ -1,23 +1,163 @@
+#define _GNU_SOURCE // fallocate, mremap, CPU affinity and RUSAGE_THREAD
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <linux/gpio.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "AIS2IH_format.h"
+#include "AIS2IH_csv.h"
+#include "AIS2IH_codec.h"
+#include "AIS2IH_arrow.h"
 
 /*
 The purpose of this program is multi-channel I2C data acquisition.
-The number of sensors and the number of samples are specified via command-line arguments.
-First, pass the number of sensors, then pass the number of samples.
-The number of sensors must be specified and must be between 1 and 4.
-The number of samples is optional. By default, data is collected for 10 seconds,
-with 1600 samples per second. The generated data is stored in the ./acc_data directory.
+The number of I2C buses and the number of samples are specified via command-line arguments.
+First, pass the number of buses, then pass the number of samples.
+The number of buses must be specified and must be between 1 and 4. Bus i is /dev/i2c-i, and it carries
+one sensor at each address given with `-a` (by default a single sensor at 0x19).
+The number of samples is optional. By default, data is collected for 10 seconds (see `-t`), or until SIGINT or SIGTERM with `-C`,
+at 1600 samples per second unless another output data rate is selected. The generated data is stored in the ./acc_data directory,
+the names of all the files of one acquisition start with the same local time, taken when it was started.
+Instead of the number of buses, a topology file can be passed with `-c`, then the only positional
+argument is the optional number of samples.
+
+Options:
+    -m poll   Check the STATUS register and read one sample at a time (default). The FIFO is bypassed and only holds
+              the newest sample, so the samples missed between two reads are not counted as lost
+    -m burst  Read the FIFO level and drain every pending sample in one burst read
+    -m paced  Sleep until the FIFO is expected to reach its watermark, then drain it in one burst read
+    -m irq    Block on the FIFO threshold interrupt of each sensor (INT1), then drain the FIFO in one burst read
+    -i LIST   Comma-separated interrupt source of each sensor for `-m irq`, one of
+                  gpiochipN:LINE  rising edges of GPIO line LINE on /dev/gpiochipN, wired to the sensor's INT1 pin
+                  fd:N            any readable event on the inherited file descriptor N, e.g. a pipe driven by a test harness
+                  timer           a timer firing every watermark's worth of sample periods, for benchmarking without the hardware
+    -r ODR    Output data rate in Hz: 1.6 (low-power only), 12.5, 25, 50, 100, 200, 400, 800 or 1600 (default)
+    -p MODE   Power mode: hp (high-performance, 14-bit, default), lp1 (low-power mode 1, 12-bit),
+              lp2, lp3 or lp4 (low-power modes 2 to 4, 14-bit, less noise and more current as the number grows).
+              The low-power modes support output data rates up to 200 Hz, lp is the same as lp4.
+    -f FS     Full-scale in g: 2, 4, 8 or 16 (default)
+    -w N      FIFO watermark in samples, 1 to 31, or auto (default) to let the bus planner size it, see below
+    -x AXES   Record only the given axes, e.g. `-x z` or `-x xy` (default xyz)
+    -b BYTES  full (default) records the full resolution, high reads and records only the OUT_*_H bytes, i.e. 8-bit data.
+              In poll mode, only the registers spanning the selected bytes are transferred, e.g. a single byte for `-x z -b high`,
+              but the span of several axes includes the low bytes between them, e.g. 5 of 6 bytes for all three axes,
+              and the FIFO is put in bypass mode. The FIFO modes still read every FIFO slot in full, since a slot is released
+              only once it has been read up to OUT_Z_H, so they only benefit from the smaller output files.
+    -t SEC    Collect SEC seconds of data when no number of samples is given, the number of samples of each
+              sensor is derived from its output data rate
+              `-r`, `-p`, `-f`, `-w`, `-x` and `-b` apply to every sensor, and are the defaults of the lines of a topology file.
+    -a LIST   Comma-separated sensor addresses on every bus, e.g. `-a 0x18,0x19` for both SA0 settings.
+              All sensors of a bus are serviced back-to-back by one thread that owns the bus.
+    -c FILE   Read the sensor topology from FILE. Each non-empty line describes one sensor as `key=value` pairs,
+              `#` starts a comment. Only `bus` is required, the other keys default to the values shown:
+                  bus=/dev/i2c-1 address=0x19 odr=1600 mode=hp fs=16 watermark=auto irq=gpiochip0:17
+              odr, mode, fs, watermark, axes and bytes take the values of `-r`, `-p`, `-f`, `-w`, `-x` and `-b`, irq is the interrupt
+              source for `-m irq`, see `-i`. Up to two sensors can share a bus.
+    -o FORMAT csv (default) writes one "x,y,z" text line per sample to acc_data/TIME_sensorN.csv,
+              bin writes the compact binary format of AIS2IH_format.h to acc_data/TIME_sensorN.bin: a header with the
+              sensor, its configuration and the start time, then blocks of int16 samples. Read it back with AIS2IH_read.
+              packed writes the same binary format with lossless compression (CODEC_DELTA_PACK): blocks of up to
+              CODEC_FRAME samples hold the per-axis deltas, zigzag-mapped and bit-packed, usually a third of the raw size.
+              A block is written once it is full, so at most CODEC_FRAME samples of each sensor wait in memory.
+              arrow writes an Arrow IPC file, acc_data/TIME_sensorN.arrow, that pandas (pyarrow.ipc.open_file, read_feather)
+              and polars (read_ipc) load without parsing, or memory-map and use in place. It has one int16 column per
+              recorded axis and a `timestamp` column in ns since the epoch, the sensor configuration is in the schema
+              metadata, see AIS2IH_arrow.h. The timestamp of each sample is derived from the time its block was read
+              and the estimated sample period, and is never earlier than the one before. The samples are written in record
+              batches of ARROW_BATCH samples.
+              Every file of any format comes with FILE.time: the CLOCK_MONOTONIC_RAW and CLOCK_REALTIME read times
+              of every batch of samples, with the sample period measured on CLOCK_MONOTONIC_RAW, 32 bytes per batch,
+              from which `AIS2IH_read -s` dates every sample, see AIS2IH_format.h. The period is a least-squares fit
+              of the read times against the sample count over the whole acquisition, with a new intercept after every gap,
+              its last value is stored in the header of the time file and printed at the end with its standard error,
+              and `AIS2IH_read -d` resamples a recording with it. If the read times stray by more than FIT_MAX_DEVIATION
+              sample periods from the fit, the nominal period is stored instead and a warning is printed.
+    -M        Preallocate each output file for the whole capture with fallocate, map it in memory and store the samples
+              directly into the mapping, dirty pages are flushed asynchronously every MAP_FLUSH_BYTES. This saves
+              a write() per buffer and keeps the files contiguous on flash storage. The capture length must be known,
+              i.e. given as the number of samples or with `-t`. The binary files are preallocated to their exact size,
+              the CSV files to the longest possible lines and truncated when the capture ends.
+    -U        Write all sensors into one session recording, acc_data/TIME_session.bin, instead of one file per sensor.
+              It needs `-o bin` or `-o packed`. The blocks of all sensors are interleaved in the order they were read,
+              each with its sensor and its CLOCK_MONOTONIC read time, see AIS2IH_format.h, so AIS2IH_read streams
+              every channel in time order in one pass. A block is written once every running sensor has a later one,
+              which holds the blocks of fast sensors in memory for up to two drain periods of the slowest one.
+    -C        Collect samples until SIGINT (Ctrl-C) or SIGTERM, the number of samples and `-t` are then ignored.
+              In every mode, the first SIGINT or SIGTERM stops the acquisition cleanly: the samples read so far are written
+              and the files are completed. A second one terminates the program at once.
+    -R SIZE   Start a new output file once the current one holds SIZE bytes, e.g. `-R 512M`, with K, M or G suffixes
+    -T SEC    Start a new output file every SEC seconds, measured by the read time of the samples
+              With `-R` or `-T`, the files are named TIME_sensorN_SEGMENT, or TIME_session_SEGMENT with `-U`, SEGMENT counting
+              from 0000, with more digits past 9999. No sample is lost at a boundary, since the writer thread switches
+              files between two blocks while the sensors keep running, and each binary file records the index of its first
+              sample since the start.
+    -B SIZE   Disk budget of the acquisition with `-R` or `-T`, e.g. `-B 20G`: once its files, with their time files,
+              indexes and pyramids, take more than SIZE bytes, the oldest completed files are deleted
+    -I SEC    Write a sparse index next to every csv, bin or packed file, FILE.idx, with one entry every SEC seconds mapping
+              the time of a sample to the offset of its block in the file, see AIS2IH_format.h. `AIS2IH_read -b -e` then
+              extracts any time window of a long recording with a binary search instead of a scan from the start.
+    -P        Build a pyramid next to every file of a sensor, FILE.pyr, with the minimum, maximum and mean of every axis
+              over 64, 128, 256... samples up to the whole file, see AIS2IH_format.h. It is built as the samples are
+              written, so a viewer draws any zoom level of a long recording from a few kilobytes, e.g. with
+              `AIS2IH_read -n 2000 FILE.pyr`. It does not apply to a session recording.
+    -Q PRIO   Run the bus threads under SCHED_FIFO at priority PRIO, 1 to 99, e.g. `-Q 80`, so that no normal process delays
+              their wakeups. `-Q 80,40` also runs the writer thread under SCHED_FIFO at priority 40, below the bus threads since
+              it only has to keep up on average. It needs root, CAP_SYS_NICE or an RLIMIT_RTPRIO of at least PRIO.
+    -A LIST   Comma-separated CPU of each bus thread, in bus order, then optionally of the writer thread, e.g. `-A 2,3,1`.
+              A pinned thread keeps its caches, and a CPU isolated from the scheduler (isolcpus=) leaves it undisturbed.
+    -L        Lock the whole memory of the program with mlockall, so that no page is swapped out or faulted in during
+              the acquisition, and touch PREFAULT_STACK bytes of the stack of every thread before it starts. The threads
+              get RT_STACK_SIZE stacks, since every page of a stack is then locked. Locking needs root, CAP_IPC_LOCK or
+              a large enough RLIMIT_MEMLOCK, without them the stacks are only prefaulted. It cannot be combined with `-M`.
+    -F        Start even if the bus planner finds that a bus cannot keep up with its sensors
+    -S US     Replace the I2C buses with simulated AIS2IH sensors, each bus transaction takes US microseconds
+              plus the transfer time at SIM_BUS_CLOCK. The FIFO of a simulated sensor fills at the configured output
+              data rate and overflows like the real one, so throughput and losses can be measured off-target. Like the
+              real parts, every simulated sensor runs a few hundred ppm off its nominal output data rate.
+Before the acquisition starts, every bus is profiled: the SCL clock of the adapter is read from
+/sys/class/i2c-adapter/i2c-N/of_node/clock-frequency (like show_i2c_details.sh does), and the time of a register read
+is measured against its length. From this cost, the planner sizes the automatic watermarks so that every FIFO can
+absorb the drain of the whole bus before it overflows, with the fewest transactions. A bus that cannot keep up with the
+output data rates of its sensors is refused unless `-F` is given, a bus close to its limits only gets a warning.
+The sensors are configured in power-down. Once every bus thread has configured its sensors, the threads meet at a barrier
+and all set the output data rate of their sensors at the same instant, START_DELAY_US later, recording when each one was
+started in the time files, so that `AIS2IH_read -g` can resample the sensors of a session recording onto one time grid.
+Every drain of a FIFO compares its level with the conversions made since the previous drain. When its overrun flag, FIFO_OVR,
+is set, or fewer samples are waiting than the sensor certainly converted, the samples overwritten since the previous drain
+are counted from the time elapsed and skipped in the sample indexes. The binary recordings get a gap record in place of
+every run of lost samples, see AIS2IH_format.h, and the losses of every sensor and of the whole acquisition are printed
+at the end, with the samples dropped because the writer thread fell behind. In poll mode there is no FIFO to compare,
+a sample overwritten before it was read leaves no trace, so only the dropped samples are counted.
+At the end, every bus thread prints its jitter report with its settings of `-Q`, `-A` and `-L`: in paced and burst modes, how
+late it woke up from its sleeps (mean, 99th percentile and maximum), then in every mode how often it moved to another CPU,
+was preempted (involuntary context switches) and faulted on a page since its sensors started. Comparing the reports of
+runs with and without each option shows what it buys on a given board.
+Example: ./AIS2IH -m burst 4 16000
+         ./AIS2IH -m paced -a 0x18,0x19 4
+         ./AIS2IH -m irq -i gpiochip0:17,gpiochip0:27 2
+         ./AIS2IH -m paced -c rig.conf 16000
+         ./AIS2IH -m paced -Q 80,40 -A 2,3,1 -L -a 0x18,0x19 2
 */
 
 #define DEBUG_MOD 0 // Debug mode switch, detailed information will be printed in debug mode
@@ -26,6 +166,7 @@ with 1600 samples per second. The generated data is stored in the ./acc_data dir
 #define CTRL1 0x20
 #define CTRL2 0x21
 #define FIFO_CTRL 0x2E
+#define CTRL4_INT1_PAD_CTRL 0x23
 #define CTRL6 0x25
 #define STATUS 0x27 // Status register, the least significant bit indicates new data is available when it is 1
 #define OUT_X_L 0x28
@@ -34,313 +175,3442 @@ with 1600 samples per second. The generated data is stored in the ./acc_data dir
 #define OUT_Y_H 0x2B
 #define OUT_Z_L 0x2C
 #define OUT_Z_H 0x2D
-#define SENSOR_ADDRESS 0x19   // Sensor address
-#define BUFFER_SIZE 6         // Buffer array size
-#define SAMPLE_FREQUENCY 1600 // Sampling frequency
-#define DEFAULT_TIME 10       // Default sampling time
+#define CTRL7 0x3F
+#define FIFO_SAMPLES 0x2F // FIFO status [FIFO_FTH FIFO_OVR Diff5 ... Diff0], Diff is the number of unread samples
+#define SENSOR_ADDRESS 0x19   // Default sensor address, SA0 pulled high
+#define MAX_BUS_SENSORS 2     // Number of sensors one bus can carry, at 0x18 (SA0 low) and 0x19 (SA0 high)
+#define BUFFER_SIZE 6         // Size of one sample, i.e., [X_L, X_H, Y_L, Y_H, Z_L, Z_H]
+#define FIFO_DEPTH 32         // Number of samples the FIFO can hold
+#define FIFO_WATERMARK 16     // FIFO threshold (FTH) of an automatic watermark in the modes that do not wait for it
+#define RING_BLOCKS 1024      // Number of sample blocks buffered between a bus thread and the writer thread, a power of two
+#define WRITER_IDLE_US 2000   // Sleep of the writer thread when every ring is empty
+#define WRITER_BUFFER (1 << 20) // Buffer of each output file, the writer thread issues a single write() per full buffer
+#define MAP_FLUSH_BYTES (8 << 20) // Amount of data written to a mapped output file between asynchronous flushes, see `-M`
+#define ROTATE_SLACK (1 << 20) // Room preallocated beyond `-R` in a mapped output file, the last block of a file ends past the limit
+#define PYRAMID_SHIFT 6       // A record of the first level of a pyramid covers 2^PYRAMID_SHIFT samples, see `-P`
+#define PYRAMID_BUFFER 64     // Records of each level of a pyramid collected before they are written
+#define LEVEL_ATTEMPTS 3      // Reads of the FIFO level a drain makes at most while one is delayed by more than half a sample period
+#define FIT_MAX_DEVIATION 1.0 // Standard deviation of the read times from the fit, in sample periods, above which the measured period is not trusted
+#define START_DELAY_US 2000   // Time between the release of the bus threads and the start of every sensor, to absorb their wakeup
+#define RT_STACK_SIZE (256 << 10) // Stack of every thread with `-L`, instead of the default 8 MB that would all be locked
+#define PREFAULT_STACK (64 << 10) // Part of its stack every thread touches before the acquisition with `-L`
+#define JITTER_BINS 16        // Bins of the wakeup latency histogram of a bus, bin k counts the latencies below 2^k microseconds
+#define PLAN_REPEAT 15        // Number of reads timed per transfer length when a bus is profiled
+#define PLAN_MARGIN_US 2000   // Scheduling latency every FIFO must be able to absorb on top of the bus traffic
+#define PLAN_MAX_LOAD 0.75    // Fraction of the bus time above which the planner warns
+#define SAMPLE_FREQUENCY 1600 // Default sampling frequency
+#define DEFAULT_TIME 10       // Default sampling time in seconds
+#define SIM_BUS_CLOCK 400000  // Clock frequency of the simulated I2C buses
+
+// Acquisition modes
+typedef enum AcqMode
+{
+    MODE_POLL,  // Poll the STATUS register and read one sample per data-ready
+    MODE_BURST, // Poll the FIFO level and drain all pending samples in one burst read
+    MODE_PACED, // Sleep until the FIFO should hold a watermark's worth of samples, then drain it
+    MODE_IRQ,   // Block on the FIFO threshold interrupt, then drain the FIFO
+} AcqMode;
+
+// Output file formats
+typedef enum OutputFormat
+{
+    FORMAT_CSV,    // One "x,y,z" text line per sample
+    FORMAT_BIN,    // Binary recording, see AIS2IH_format.h
+    FORMAT_PACKED, // Binary recording compressed with CODEC_DELTA_PACK, see AIS2IH_codec.h
+    FORMAT_ARROW,  // Arrow IPC file, see AIS2IH_arrow.h
+} OutputFormat;
+
+// Configuration of one sensor, read from the topology file (`-c`) or derived from the command-line
+typedef struct SensorConfig
+{
+    char bus[64];  // Path of the bus device, e.g. /dev/i2c-1
+    int address;   // Slave address, 0x18 or 0x19
+    double odr;    // Output data rate in Hz
+    int powerMode; // Index of the power mode in `powerModes`
+    int fullScale; // Full-scale in g
+    int watermark; // FIFO threshold (FTH) in samples, 0 to let the bus planner size it
+    int axes;      // Bit mask of the recorded axes, 1 = X, 2 = Y, 4 = Z
+    int highOnly;  // 1 to read and record only the OUT_*_H bytes
+    char irq[64];  // Interrupt source for the irq mode, see `-i`, empty if not given
+} SensorConfig;
+
+// Power modes, and the bits MODE[1:0] LP_MODE[1:0] of CTRL1 selecting them
+typedef struct PowerMode
+{
+    const char *name;
+    unsigned char ctrl1Bits; // MODE[1:0] and LP_MODE[1:0]
+    int resolution;          // Number of significant bits of the left-justified output
+    double maxOdr;           // Highest output data rate of the mode in Hz
+} PowerMode;
+
+const PowerMode powerModes[] = {
+    {"hp", 0x07, 14, 1600}, // High-performance mode
+    {"lp1", 0x00, 12, 200}, // Low-power mode 1
+    {"lp2", 0x01, 14, 200}, // Low-power mode 2
+    {"lp3", 0x02, 14, 200}, // Low-power mode 3
+    {"lp4", 0x03, 14, 200}, // Low-power mode 4
+    {"lp", 0x03, 14, 200},  // Alias of low-power mode 4
+};
+
+// A file descriptor that becomes readable whenever the sensor's FIFO reaches its watermark
+// The acquisition loop only polls `fd` and calls `consume`, so real GPIO lines and test doubles are interchangeable
+typedef struct EventSource
+{
+    int fd;                                     // Readable when an event is pending, -1 if the source is not opened
+    int (*consume)(struct EventSource *source); // Consume all pending events after `fd` became readable, return 0 on success
+} EventSource;
 
-int sampleNum = SAMPLE_FREQUENCY * DEFAULT_TIME; // Total number of samples
-int sensorNum = 0;                               // Number of sensors passed via command-line
+long long sampleNum = 0;                         // Number of samples per sensor passed via command-line, 0 to derive it from `duration`
+double duration = DEFAULT_TIME;                  // Sampling time in seconds, see `-t`
+SensorConfig defaultConfig;                      // Configuration every sensor starts from, see `-r`, `-p`, `-f` and `-w`
+int busNum = 0;                                  // Number of I2C buses
+int sensorNum = 0;                               // Number of sensors
+SensorConfig *sensorConfigs = NULL;              // Configuration of each sensor
+const char *topologyFile = NULL;                 // Topology file passed via command-line, see `-c`
+int sensorAddresses[MAX_BUS_SENSORS] = {SENSOR_ADDRESS}; // Addresses of the sensors on each bus, see `-a`
+int addressNum = 1;                              // Number of sensors on each bus
+AcqMode acqMode = MODE_POLL;                     // Acquisition mode selected via command-line
+OutputFormat outputFormat = FORMAT_CSV;          // Output file format, see `-o`
+int mapOutput = 0;                               // 1 to preallocate and map the output files, see `-M`
+char *irqSpecs = NULL;                           // Interrupt source of each sensor passed via command-line, see `-i`
+int forcePlan = 0;                               // 1 to start even if the bus planner refuses a bus, see `-F`
+int sessionOutput = 0;                           // 1 to write all sensors into one session recording, see `-U`
+char sessionTime[16];                            // Local start time of the acquisition, the first part of every file name
+int continuous = 0;                              // 1 to collect samples until SIGINT or SIGTERM, see `-C`
+unsigned long long rotateBytes = 0;              // Size of an output file before the next one is started, 0 for no limit, see `-R`
+long long rotateNs = 0;                          // Duration of an output file before the next one is started, 0 for no limit, see `-T`
+unsigned long long diskBudget = 0;               // Largest size of all files of the acquisition, 0 for no limit, see `-B`
+long long indexIntervalNs = 0;                   // Time between two entries of the index of every output file, 0 for no index, see `-I`
+int pyramidOutput = 0;                           // 1 to build the min, max and mean pyramid of every output file, see `-P`
+int busPriority = 0;                             // SCHED_FIFO priority of the bus threads, 0 for the default scheduling, see `-Q`
+int writerPriority = 0;                          // SCHED_FIFO priority of the writer thread, 0 for the default scheduling, see `-Q`
+int *cpuList = NULL;                             // CPU of each bus thread, then of the writer thread, see `-A`
+int cpuNum = 0;                                  // Number of entries in `cpuList`
+int lockMemory = 0;                              // 1 to lock the memory of the process and prefault the thread stacks, see `-L`
+int memoryLocked = 0;                            // 1 once mlockall succeeded
+atomic_int stopRequested = 0;                    // Set by SIGINT and SIGTERM, the bus threads then complete their files and exit
+atomic_int acquisitionDone = 0;                  // Set once every bus thread finished, the writer thread then drains the rings and exits
+pthread_barrier_t startBarrier;                  // Met by the bus threads to start all sensors together
+struct timespec startTime;                       // CLOCK_MONOTONIC time at which every sensor is started
+int simLatencyUs = -1;                           // Latency of a simulated bus transaction, -1 to use the real I2C buses
 const char data_path[] = "acc_data";             // Data storage directory
 
+struct SensorInfo;
+struct BusInfo;
+
+// Operations of a bus backend, every register access of a sensor goes through them
+typedef struct BusBackend
+{
+    const char *name;
+    int (*open)(struct BusInfo *bus);                                                      // Open the bus at `bus->path`, return 0 on success
+    int (*attach)(struct SensorInfo *arg);                                                 // Address a sensor on its opened bus, return 0 on success
+    int (*write)(struct SensorInfo *arg, const unsigned char *data, int length);           // Write a register address followed by values, return 0 on success
+    int (*read)(struct SensorInfo *arg, unsigned char regAddress, void *buffer, int length); // Read `length` bytes from a register, return 0 on success
+    void (*detach)(struct SensorInfo *arg);                                                // Release a sensor
+    void (*close)(struct BusInfo *bus);                                                    // Close the bus
+} BusBackend;
+
+// Define a structure to hold the parameters of each I2C bus, all its sensors are serviced by one thread
+typedef struct BusInfo
+{
+    int busIndex;                                  // Bus index
+    char path[64];                                 // Path of the bus device, e.g. /dev/i2c-1
+    const BusBackend *backend;                     // Bus backend, NULL if the bus could not be opened
+    int i2cFile;                                   // Corresponding I2C device
+    int combinedRead;                              // 1 if the adapter supports I2C_RDWR, i.e., write-then-read with a repeated start
+    int selectedAddress;                           // Slave address last selected with I2C_SLAVE, for plain write() and read()
+    long clockHz;                                  // SCL frequency of the adapter, 0 if unknown
+    double fixedCostNs;                            // Measured time of a register read, independent of its length
+    double byteCostNs;                             // Measured time of every byte of a register read
+    struct SensorInfo *sensors[MAX_BUS_SENSORS];   // Sensors on this bus
+    int sensorCount;                               // Number of sensors on this bus
+    int priority;                                  // SCHED_FIFO priority of the thread of the bus, 0 for the default scheduling
+    int cpu;                                       // CPU the thread of the bus is pinned to, -1 if it may run on any
+    long long wakeups;                             // Number of timed sleeps of the loop, in paced and burst modes
+    long long latencySumNs;                        // Sum of the delays between the end of a sleep and the actual wakeup
+    long long latencyMaxNs;                        // Largest delay of a wakeup
+    unsigned latencyHistogram[JITTER_BINS];        // Number of wakeups delayed by less than 2^k microseconds, beyond the previous bin
+    int lastCpu;                                   // CPU the loop last ran on, -1 before the first iteration
+    unsigned migrations;                           // Number of times the loop found itself on another CPU
+} BusInfo, *pBus;
+
+// State of a simulated AIS2IH, see `-S`
+typedef struct SimDevice
+{
+    unsigned char regs[128];                         // Register map
+    unsigned char fifo[FIFO_DEPTH][BUFFER_SIZE];     // FIFO slots, each holding [X_L, X_H, Y_L, Y_H, Z_L, Z_H]
+    int fifoHead;                                    // Index of the oldest sample in the FIFO
+    int fifoCount;                                   // Number of samples in the FIFO
+    struct timespec odrStart;                        // Time CTRL1 was last written, conversions are counted from here
+    long long produced;                              // Number of conversions since `odrStart`
+    long long delivered;                             // Number of samples read out
+    long long overwritten;                           // Number of samples lost to FIFO overruns
+    long long overwrittenRead;                       // Value of `overwritten` when a sample was last read out
+    int waveX, waveY;                                // State of the simulated vibration
+    unsigned int noise;                              // State of the simulated noise
+    int ppm;                                         // Deviation of the simulated oscillator from the nominal output data rate
+} SimDevice;
+
+// A block of raw samples on its way from a bus thread to the writer thread
+typedef struct RingBlock
+{
+    unsigned long long firstSample;     // Index of the first sample since the start of the recording
+    int count;                          // Number of samples in the block
+    unsigned char rawStart;             // Register of the first byte of each sample
+    int rawStride;                      // Number of bytes of each sample
+    long long timestampNs;              // CLOCK_MONOTONIC when the last sample of the block was read
+    long long rawNs;                    // CLOCK_MONOTONIC_RAW at the same moment, free of the NTP frequency corrections
+    long long realtimeNs;               // CLOCK_REALTIME at the same moment
+    char raw[FIFO_DEPTH * BUFFER_SIZE]; // Samples as read from the sensor
+} RingBlock;
+
+// Lock-free single-producer single-consumer ring of blocks, the bus thread of the sensor pushes and the writer thread pops
+// Only the producer stores `head` and only the consumer stores `tail`, their release stores publish the blocks in between
+typedef struct SampleRing
+{
+    _Alignas(64) atomic_uint head; // Number of blocks pushed
+    _Alignas(64) atomic_uint tail; // Number of blocks popped
+    atomic_int closed;             // 1 once the producer published its last block
+    unsigned highWater;            // Largest number of blocks seen waiting, maintained by the producer
+    unsigned long long dropped;    // Number of samples dropped because the ring was full, maintained by the producer
+    unsigned long long overwritten; // Number of samples overwritten in the FIFO before they were read, estimated by the producer
+    unsigned overruns;             // Number of drains that found samples overwritten, maintained by the producer
+    RingBlock blocks[RING_BLOCKS];
+} SampleRing;
+
+// Output file of a sensor, written by the writer thread through a large buffer, or mapped in memory, see `-M`
+typedef struct OutputFile
+{
+    int fd;           // File descriptor, -1 if the file is not open
+    int mapped;       // 1 if `data` maps the whole preallocated file, 0 if it buffers the next write()
+    char *data;       // Mapping or write buffer
+    size_t size;      // Size of `data`, i.e. of the mapped file or WRITER_BUFFER
+    size_t used;      // Number of bytes in `data`, the mapped file is truncated to it when it is closed
+    size_t flushed;   // Number of mapped bytes handed to msync
+    size_t lastBlock; // Offset of the header of the last block of a mapped binary recording, 0 before the first block
+    unsigned long long length; // Number of bytes appended to the file
+    long long startNs; // Read time of the first block of the file, 0 before it, see `-T`
+    char path[64];    // Path of the file
+    FILE *index;      // Index of the file, NULL without `-I`
+    long long indexNextNs; // Time from which the next block gets an index entry
+    FILE *times;      // Time file of the file, FILE.time
+    unsigned long long batches; // Number of records in the time file, its header is written with the first one
+    struct SensorInfo *timeSensors; // Sensors of the file, listed in the header of the time file
+    int timeSensorCount; // Number of sensors in `timeSensors`
+} OutputFile;
+
+// Pyramid of the min, max and mean of an output file, built by the writer thread, see `-P`
+typedef struct Pyramid
+{
+    int fd;                                      // File descriptor
+    short *records;                              // PYRAMID_BUFFER records of each level waiting to be written, NULL if the pyramid is not open
+    int buffered[PYRAMID_LEVELS];                // Number of records waiting in `records` for each level
+    uint64_t capacity[PYRAMID_LEVELS];           // Number of records the region of each level holds
+    long long count[PYRAMID_LEVELS];             // Number of samples in the pending record of each level, lost ones included
+    long long valid[PYRAMID_LEVELS];             // Number of those samples that were recorded, the extremes and sum are theirs
+    short min[PYRAMID_LEVELS][3], max[PYRAMID_LEVELS][3]; // Extremes of the pending record of each level
+    long long sum[PYRAMID_LEVELS][3];            // Sum of the pending record of each level
+    PyramidHeader header;                        // Header of the file, with the number of records written of each level
+} Pyramid;
+
+// A completed output file, kept by the writer thread to enforce the disk budget, see `-B`
+typedef struct Segment
+{
+    char path[64];             // Path of the file
+    unsigned long long length; // Size of the file, its time file, its index and its pyramid
+} Segment;
+
+OutputFile sessionFile = {.fd = -1}; // Session recording of all sensors, written by the writer thread, see `-U`
+int sessionSegment = 0;              // Number of the current file of the session recording, see `-R` and `-T`
+Segment *segments = NULL;            // Completed files of the acquisition, oldest first, written by the writer thread
+int segmentFirst = 0;                // Index of the oldest file in `segments` that still exists
+int segmentCount = 0;                // Number of entries in `segments`
+int segmentSize = 0;                 // Number of entries allocated in `segments`
+const char *const sidecarSuffixes[] = {".time", ".idx", ".pyr"}; // Suffixes of the time file, the index and the pyramid of an output file
+
+// Record batch of an Arrow output file being filled by the writer thread, see `-o arrow`
+typedef struct ArrowBatch
+{
+    short *columns;             // ARROW_BATCH values of each recorded axis, one column after the other
+    int64_t *timestamps;        // Timestamp of each sample in ns since the epoch
+    int rows;                   // Number of samples in the batch
+    int64_t lastTimestamp;      // Timestamp of the last sample written to the file, the next one is not dated earlier
+    ArrowBlock *blocks;         // Position of every record batch written, for the footer
+    int blockCount;             // Number of record batches written
+    int blockSize;              // Number of entries allocated in `blocks`
+    RecordingHeader header;     // Configuration of the sensor, stored in the schema metadata
+    ArrowBuilder builder;       // Flatbuffer of the last message
+} ArrowBatch;
+
 // Define a structure to hold the parameters of each accelerometer
 typedef struct SensorInfo
 {
-    int sensorIndex;             // Sensor index
-    int i2cFile;                 // Corresponding I2C device
-    char msgBuffer[BUFFER_SIZE]; // Buffer array
+    int sensorIndex;                          // Sensor index
+    SensorConfig cfg;                         // Configuration of the sensor
+    pBus bus;                                 // I2C bus the sensor is connected to
+    int i2cAddress;                           // Slave address of the sensor on its I2C bus
+    SimDevice *sim;                           // Corresponding simulated device, see `-S`
+    EventSource event;                        // FIFO threshold interrupt source, used by the irq mode
+    int attached;                             // 1 once the sensor has been addressed on its bus
+    int ready;                                // 1 once the sensor has been opened and configured
+    OutputFile out;                           // Output file, written by the writer thread, not opened for a session recording
+    int finished;                             // 1 once the writer thread wrote the last block of the sensor
+    short frame[CODEC_FRAME * 3];             // Converted samples waiting to be compressed by the writer thread, see `-o packed`
+    int frameCount;                           // Number of samples in `frame`
+    unsigned long long frameFirst;            // Index of the first sample in `frame`
+    ArrowBatch arrow;                         // Record batch waiting to be written, see `-o arrow`
+    Pyramid pyramid;                          // Pyramid of the output file, see `-P`
+    SampleRing *ring;                         // Blocks of samples waiting for the writer thread
+    int pending;                              // Number of samples in the unpublished block at the head of the ring
+    unsigned long long written;               // Number of samples handed to the writer thread, including the dropped and overwritten ones
+    long long newestRawNs;                    // CLOCK_MONOTONIC_RAW when the FIFO was last drained, i.e. of its newest sample then
+    int leftInFifo;                           // Number of samples left in the FIFO by the last drain
+    int overrunHidden;                        // 1 if the FIFO may have filled up before the last drain read it, the read then cleared FIFO_OVR
+    long long sampleTarget;                   // Number of samples to collect, LLONG_MAX with `-C`
+    long long remaining;                      // Number of samples still to be collected
+    unsigned long long nextSample;            // Index of the next sample the writer thread expects, the first one of a new file
+    unsigned long long gapSamples;            // Number of samples lost before the blocks that followed a gap, see writeGap
+    unsigned gaps;                            // Number of gap records written
+    int segment;                              // Number of the current output file, see `-R` and `-T`
+    long long anchorRawNs;                    // CLOCK_MONOTONIC_RAW read time of the first block, 0 before it, the origin of the fit
+    double fitCount;                          // Number of blocks in the fit of the sample period since the last gap
+    double fitMeanSample;                     // Mean index of the last sample of these blocks
+    double fitMeanNs;                         // Mean read time of these blocks from `anchorRawNs`
+    double fitSampleSquares;                  // Sum of the squared deviations of their sample indexes from their mean
+    double fitProducts;                       // Sum of the products of the deviations of their sample indexes and read times
+    double fitTimeSquares;                    // Sum of the squared deviations of their read times from their mean
+    double fitBlocks;                         // Number of blocks in the fit before the last gap
+    int fitRuns;                              // Number of runs of blocks between gaps before the last gap
+    double fitPooledSamples, fitPooledProducts, fitPooledTimes; // Sums of squares and products of those runs
+    double fitNextSample, fitNextNs;          // Last sample index and read time of the block waiting to enter the fit
+    int fitWaiting;                           // 1 if a block is waiting to enter the fit, it is left out if a gap follows it
+    double estimatedPeriodNs;                 // Sample period measured by the writer thread since the first block, the nominal one if uncertain
+    double periodErrorPpm;                    // Standard error of the measured period in ppm, 0 until it is measured
+    double fitDeviation;                      // Standard deviation of the read times from the fit in sample periods, see FIT_MAX_DEVIATION
+    long long firstRawNs;                     // CLOCK_MONOTONIC_RAW of the first sample, one period after the sensor was started, 0 before
+    long long firstRealtimeNs;                // CLOCK_REALTIME of the first sample
+    int sampleShift;                          // Right shift turning the left-justified output into a sample of the mode's resolution
+    long long periodNs;                       // Time it takes the sensor to produce one sample
+    struct timespec deadline;                 // Absolute time of the next paced drain
+    int channels;                             // Number of recorded axes
+    unsigned char readStart;                  // First register read per sample in poll mode
+    int readLength;                           // Number of registers read per sample in poll mode
+    char msgBuffer[FIFO_DEPTH * BUFFER_SIZE]; // Buffer array, large enough for a full FIFO
 } SensorInfo, *pSensor;
 
 // Function prototypes
 
 void prepare_args(int argc, char *argv[]);                                     // Check command-line arguments and prepare
-void initSensors(pSensor sensorPointer);                                       // Initialize the basic information of each sensor
-int writeRegister(int i2cFile, unsigned char regAddress, unsigned char value); // Write data to a specific register of an I2C device
-unsigned char readRegOneByte(int i2cFile, unsigned char regAddress);           // Read 1 byte from a specific register of an I2C device
+int parseSensorSetting(SensorConfig *cfg, const char *key, const char *value); // Apply one `key=value` setting to a sensor configuration
+int odrCode(double odr);                                                       // Return the ODR[3:0] bits of CTRL1 selecting an output data rate
+int checkSensorConfig(const SensorConfig *cfg);                                // Check that the output data rate is supported in the power mode
+int fullScaleCode(int fullScale);                                              // Return the FS[1:0] bits of CTRL6 selecting a full-scale
+void loadTopology(const char *path);                                           // Read the configuration of every sensor from a topology file
+int initSensors(pBus busPointer, pSensor sensorPointer);                        // Initialize the basic information of each bus and sensor, return the number of buses
+int writeRegister(pSensor arg, unsigned char regAddress, unsigned char value); // Write data to a specific register of an I2C device
+int readRegisters(pSensor arg, unsigned char regAddress, void *buffer, int length); // Read `length` bytes starting from a specific register of an I2C device
+unsigned char readRegOneByte(pSensor arg, unsigned char regAddress);           // Read 1 byte from a specific register of an I2C device
 void readRegBytes(pSensor arg, unsigned char regAddress, int bufferSize);      // Read `bufferSize` bytes from a specific register of an I2C device
+int openEventSource(EventSource *source, const char *spec, long long periodNs); // Open the interrupt source described by `spec`, see `-i`
+void closeEventSource(EventSource *source);                                     // Close an interrupt source, if it is open
+int waitEvents(EventSource *sources[], int count, int timeoutMs);             // Wait up to `timeoutMs` for an event of any source, return the number of events, -1 on error
+long long timeRead(pSensor arg, unsigned char regAddress, int length);         // Return the median time of a read of `length` bytes, -1 on error
+double readCostNs(pBus bus, int length);                                       // Return the expected time of a read of `length` bytes on a profiled bus
+int planBus(pBus arg);                                                         // Profile a bus and size the watermarks of its sensors, return 1 if it cannot keep up
+void openBusEvents(pBus arg, pSensor sensors[], int count);                    // Print the watermarks of the sensors of a bus and open their interrupt sources
 int setup(pSensor arg);                                                        // Initialize and configure an I2C device
-void loop(pSensor arg);                                                        // Loop to read data from an I2C device and write it to a file
-void *sensorThread(void *arg);                                                 // Thread executed by each accelerometer
+int startSensor(pSensor arg);                                                  // Set the output data rate of a configured sensor and record when it started
+int convertSamples(pSensor arg, const RingBlock *block, short *out);           // Convert the raw samples of a block, return the number of values per sample
+void pushSamples(pSensor arg, unsigned char rawStart, int rawStride, int count, int newer, long long reportedRawNs); // Queue `count` raw samples of `msgBuffer` for the writer thread
+void publishSamples(pSensor arg);                                              // Hand the block being filled over to the writer thread
+char *outputReserve(OutputFile *out, size_t length);                          // Return where up to `length` bytes can be appended to an output file
+void outputCommit(OutputFile *out, size_t length);                             // Append the `length` bytes stored at outputReserve
+void outputWrite(OutputFile *out, const void *data, size_t length);            // Append `length` bytes to an output file
+void flushOutput(OutputFile *out);                                             // Write the buffered bytes of an output file
+void openFile(OutputFile *out, const char *path, size_t mapSize);              // Open an output file, preallocated to `mapSize` bytes and mapped with `-M`
+void closeFile(OutputFile *out);                                               // Flush and close an output file
+void writeRecord(FILE *file, const void *record, size_t size, const char *message); // Write a record to a time file or an index, report the first failure
+void openIndex(OutputFile *out, pSensor arg);                                  // Open the index of an output file, see `-I`
+void writeIndex(OutputFile *out, long long timestampNs, unsigned long long firstSample); // Add an index entry for the block about to be written
+void openTimes(OutputFile *out, pSensor sensors, int count);                   // Open the time file of an output file of `count` sensors
+void writeTimeHeader(OutputFile *out, int closing);                            // Write the header of a time file with the start and the period of its sensors
+void writeTimes(OutputFile *out, pSensor arg, const RingBlock *block);         // Measure the sample period and record the times of a block
+void openPyramid(pSensor arg, long long samples);                               // Open the pyramid of the output file of a sensor, sized for `samples`, see `-P`
+void addPyramid(Pyramid *pyramid, const short *samples, int count, int channels); // Aggregate converted samples into a pyramid
+void skipPyramid(Pyramid *pyramid, unsigned long long count);                 // Move a pyramid over `count` lost samples
+void emitPyramid(Pyramid *pyramid, int level);                                 // Store the pending record of a level and pass it to the next level
+void flushPyramid(Pyramid *pyramid);                                           // Write the collected records and the header of a pyramid
+void closePyramid(Pyramid *pyramid);                                           // Store the partial records, close up the levels and close a pyramid
+void writeFrame(pSensor arg);                                                  // Compress the samples waiting in `frame` into one block
+void writeArrowBatch(pSensor arg);                                             // Write the samples waiting in the Arrow record batch
+void writeArrowFooter(pSensor arg);                                            // Write the last Arrow record batch and the footer
+void releaseOutput(pSensor arg);                                               // Flush and close the output file of a sensor
+int rotationDue(const OutputFile *out, const RingBlock *block);                // Return 1 if `block` must start a new output file, see `-R` and `-T`
+void retireSegment(const OutputFile *out);                                     // Record a completed output file for the disk budget
+unsigned long long sidecarLength(const char *path);                            // Return the size of the time file, the index and the pyramid of an output file
+void enforceBudget(pSensor sensors);                                           // Delete the oldest completed files while the acquisition exceeds its disk budget
+void writeGap(pSensor arg, const RingBlock *block);                            // Record the samples lost before a block, if any
+void writeBlock(pSensor arg, const RingBlock *block);                          // Convert a block and write it to the output file
+void writeSessionBlock(pSensor arg, const RingBlock *block);                   // Convert a block and write it to the session recording
+int drainRing(pSensor arg);                                                    // Write every block waiting in the ring of a sensor, return their number
+int mergeRings(pSensor sensors, long long windowNs);                          // Write the blocks of all rings to the session recording in time order, return their number
+void closeOutput(pSensor arg);                                                 // Tell the writer thread that a sensor pushed its last samples
+void *writerThread(void *arg);                                                 // Thread writing the samples of every sensor to its output file
+int drainFifo(pSensor arg);                                                     // Drain the FIFO in one read and queue the samples for the writer thread
+int readLevel(pSensor arg, long long *beforeNs);                                 // Read the FIFO level, book the samples lost since the last drain and return the level
+int pollSample(pSensor arg);                                                   // Read one sample if the STATUS register reports new data
+void fillHeader(pSensor arg, RecordingHeader *header, long long realtimeNs, long long monotonicNs); // Describe a sensor and its configuration for a binary recording
+void openOutput(pSensor arg);                                                  // Reset the counters of a sensor and open its first output file
+long long segmentSamples(pSensor arg);                                         // Return the largest number of samples the next output file of a sensor takes
+void openSegment(pSensor arg);                                                 // Open the next output file of a sensor
+void openSession(pSensor sensors);                                             // Open the session recording of all sensors, see `-U`
+void addNanoseconds(struct timespec *ts, long long ns);                        // Move a timespec forward (or backward) by `ns` nanoseconds
+long long diffNanoseconds(const struct timespec *a, const struct timespec *b); // Return `a` - `b` in nanoseconds
+void requestStop(int signal);                                                  // Signal handler of SIGINT and SIGTERM, ask the bus threads to stop
+unsigned long long parseSize(const char *text);                                // Parse a size in bytes with an optional K, M or G suffix, return 0 if invalid
+void loop(pBus arg);                                                           // Loop to read data from the sensors on one I2C bus and queue it for the writer thread
+void recordWakeup(pBus arg, const struct timespec *target, struct timespec *now); // Account the delay of a wakeup planned at `target` in the jitter report
+void reportJitter(pBus arg, const struct rusage *before, const struct rusage *after); // Print the wakeup latencies of a bus with the settings of its thread
+void threadAttributes(pthread_attr_t *attr, int priority, int cpu);           // Prepare the scheduling, CPU and stack of a thread, see `-Q`, `-A` and `-L`
+void createThread(pthread_t *thread, const char *name, int priority, int cpu, void *(*start)(void *), void *arg); // Create a thread with threadAttributes, exit on error
+void prefaultStack(void);                                                      // Touch the first PREFAULT_STACK bytes of the stack of the calling thread
+void *busThread(void *arg);                                                    // Thread executed by each I2C bus
+
+extern const BusBackend i2cDevBackend; // Linux i2c-dev character devices
+extern const BusBackend simBackend;    // Simulated AIS2IH sensors, see `-S`
 
 int main(int argc, char *argv[])
 {
     // Check command-line arguments and do some preparing work
     prepare_args(argc, argv);
-    // Define an array of structures to store the information of each accelerometer
-    SensorInfo accArgs[sensorNum];
-    // Initialize the basic information of each sensor
-    initSensors(accArgs);
-    // Create a thread for each accelerometer
-    pthread_t threads[sensorNum];
-    for (int i = 0; i < sensorNum; ++i)
-    {
-        // Only create a thread if the sensor opened successfully
-        if (accArgs[i].i2cFile != -1)
-        {
-            // Create a new thread that will execute the sensorThread function, and pass the basic information of the accelerometer via accArgs
-            // If the thread is created successfully, pthread_create returns 0; otherwise, it returns a non-zero value
-            if (pthread_create(&threads[i], NULL, sensorThread, (void *)&accArgs[i]) != 0)
-            {
-                printf("Failed to create thread %d\n", i);
-                exit(EXIT_FAILURE);
-            }
+    // Lock the memory before anything is allocated, so that no page of the process is faulted in or swapped out during the acquisition
+    if (lockMemory)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            memoryLocked = 1;
+        else
+            printf("Warning! Failed to lock the memory (%s), it needs root, CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK. "
+                   "The thread stacks are only prefaulted.\n", strerror(errno));
+    }
+    // Allocate arrays of structures to store the information of each bus and each accelerometer, there are at most as many buses as sensors
+    pBus busArgs = calloc(sensorNum, sizeof(BusInfo));
+    pSensor accArgs = calloc(sensorNum, sizeof(SensorInfo));
+    if (busArgs == NULL || accArgs == NULL)
+    {
+        perror("Failed to allocate sensors");
+        exit(EXIT_FAILURE);
+    }
+    // Initialize the basic information of each bus and sensor
+    busNum = initSensors(busArgs, accArgs);
+    // Profile every bus and size the FIFO bursts of its sensors before any of them starts
+    int overloaded = 0;
+    for (int i = 0; i < busNum; ++i)
+    {
+        if (busArgs[i].backend != NULL)
+            overloaded += planBus(&busArgs[i]);
+    }
+    if (overloaded > 0 && !forcePlan)
+    {
+        printf("Error! %d bus(es) cannot keep up with their sensors, samples would be lost. Use `-F` to start anyway.\n", overloaded);
+        exit(EXIT_FAILURE);
+    }
+    // The sensors of a bus that failed to open will never push a sample
+    for (int i = 0; i < sensorNum; i++)
+    {
+        if (accArgs[i].bus->backend == NULL)
+            closeOutput(&accArgs[i]);
+    }
+    if (sessionOutput)
+        openSession(accArgs);
+    // Only the main thread takes SIGINT and SIGTERM, so that they never interrupt a bus transaction or a write
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+    // The bus threads meet at the barrier to start their sensors together, and take the CPUs of `-A` in bus order
+    int threadNum = 0;
+    for (int i = 0; i < busNum; i++)
+    {
+        busArgs[i].priority = busPriority;
+        busArgs[i].cpu = -1;
+        busArgs[i].lastCpu = -1;
+        if (busArgs[i].backend == NULL)
+            continue;
+        if (threadNum < cpuNum)
+            busArgs[i].cpu = cpuList[threadNum];
+        threadNum++;
+    }
+    if (threadNum > 0)
+        pthread_barrier_init(&startBarrier, NULL, threadNum);
+    if (cpuNum > threadNum + 1)
+        printf("Warning! `-A` lists %d CPUs for %d bus thread(s) and the writer thread, the last ones are ignored.\n", cpuNum, threadNum);
+    // The writer thread stores the samples of all sensors, so that the bus threads never wait for storage
+    pthread_t writer;
+    createThread(&writer, "the writer thread", writerPriority, cpuNum > threadNum ? cpuList[threadNum] : -1, writerThread, (void *)accArgs);
+    // Create a thread for each bus, it services all accelerometers on that bus
+    pthread_t threads[busNum];
+    for (int i = 0; i < busNum; ++i)
+    {
+        // Only create a thread if the bus opened successfully
+        if (busArgs[i].backend != NULL)
+        {
+            // Create a new thread that will execute the busThread function, and pass the basic information of the bus via busArgs
+            char name[32];
+            snprintf(name, sizeof(name), "thread %d", i);
+            createThread(&threads[i], name, busArgs[i].priority, busArgs[i].cpu, busThread, (void *)&busArgs[i]);
         }
     }
+    // A first signal stops the acquisition cleanly, a second one terminates the program
+    struct sigaction stopAction = {.sa_handler = requestStop, .sa_flags = SA_RESETHAND};
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGTERM, &stopAction, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stopSignals, NULL);
     // The main thread waits for all threads to finish
-    for (int i = 0; i < sensorNum; ++i)
+    for (int i = 0; i < busNum; ++i)
+    {
+        if (busArgs[i].backend != NULL)
+            pthread_join(threads[i], NULL);
+    }
+    atomic_store(&acquisitionDone, 1);
+    pthread_join(writer, NULL);
+    if (threadNum > 0)
+        pthread_barrier_destroy(&startBarrier);
+    // Summarize the losses of the whole acquisition, to compare the settings of the acquisition by what they actually lose
+    unsigned long long total = 0, overwritten = 0, dropped = 0;
+    for (int i = 0; i < sensorNum; i++)
     {
-        pthread_join(threads[i], NULL);
+        total += accArgs[i].written;
+        overwritten += accArgs[i].ring->overwritten;
+        dropped += accArgs[i].ring->dropped;
     }
+    // Poll mode bypasses the FIFOs, the samples missed between two reads are not counted
+    const char *uncounted = acqMode == MODE_POLL ? ", the samples missed between two polls are not counted" : "";
+    if (overwritten + dropped == 0)
+        printf("No sample was lost out of %llu%s.\n", total, uncounted);
+    else
+        printf("Lost %llu of %llu samples (%.3f%%): %llu overwritten in the FIFOs, %llu dropped because the writer fell behind%s.\n",
+               overwritten + dropped, total, 100.0 * (overwritten + dropped) / total, overwritten, dropped, uncounted);
     printf("All data was saved at '%s' \n", data_path);
+    for (int i = 0; i < sensorNum; i++)
+        free(accArgs[i].ring);
+    free(segments);
+    free(accArgs);
+    free(busArgs);
+    free(sensorConfigs);
+    free(cpuList);
     return 0;
 }
 
-// Function: Initialize the basic information of each sensor
+// Function: Check command-line arguments and prepare
 void prepare_args(int argc, char *argv[])
 {
-    // Check if at least one command-line argument is passed
-    if (argc < 2)
+    // Parse the options first, the remaining arguments are the positional ones
+    parseSensorSetting(&defaultConfig, NULL, NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "m:i:S:a:c:r:p:f:w:t:x:b:o:MFUCPLR:T:B:I:Q:A:")) != -1)
     {
-        printf("Error! You must assign sensor number!\n");
-        exit(EXIT_FAILURE);
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "poll") == 0)
+                acqMode = MODE_POLL;
+            else if (strcmp(optarg, "burst") == 0)
+                acqMode = MODE_BURST;
+            else if (strcmp(optarg, "paced") == 0)
+                acqMode = MODE_PACED;
+            else if (strcmp(optarg, "irq") == 0)
+                acqMode = MODE_IRQ;
+            else
+            {
+                printf("Error! Unknown acquisition mode '%s'!\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            irqSpecs = optarg;
+            break;
+        case 'c':
+            topologyFile = optarg;
+            break;
+        case 'r':
+        case 'p':
+        case 'f':
+        case 'w':
+        case 'x':
+        case 'b':
+        {
+            // The sensor settings share their parser with the topology file
+            const char *key = opt == 'r' ? "odr" : opt == 'p' ? "mode" : opt == 'f' ? "fs" : opt == 'w' ? "watermark" : opt == 'x' ? "axes" : "bytes";
+            if (parseSensorSetting(&defaultConfig, key, optarg) != 0)
+            {
+                printf("Error! Invalid %s '%s'!\n", key, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 't':
+            duration = atof(optarg);
+            if (duration <= 0)
+            {
+                printf("Error! The sampling time must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            if (strcmp(optarg, "csv") == 0)
+                outputFormat = FORMAT_CSV;
+            else if (strcmp(optarg, "bin") == 0)
+                outputFormat = FORMAT_BIN;
+            else if (strcmp(optarg, "packed") == 0)
+                outputFormat = FORMAT_PACKED;
+            else if (strcmp(optarg, "arrow") == 0)
+                outputFormat = FORMAT_ARROW;
+            else
+            {
+                printf("Error! Unknown output format '%s'!\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            mapOutput = 1;
+            break;
+        case 'F':
+            forcePlan = 1;
+            break;
+        case 'U':
+            sessionOutput = 1;
+            break;
+        case 'P':
+            pyramidOutput = 1;
+            break;
+        case 'C':
+            continuous = 1;
+            break;
+        case 'L':
+            lockMemory = 1;
+            break;
+        case 'Q':
+        {
+            int lowest = sched_get_priority_min(SCHED_FIFO), highest = sched_get_priority_max(SCHED_FIFO);
+            char *writer = strchr(optarg, ',');
+            busPriority = atoi(optarg);
+            writerPriority = writer != NULL ? atoi(writer + 1) : 0;
+            if (busPriority < lowest || busPriority > highest || (writer != NULL && (writerPriority < lowest || writerPriority > highest)))
+            {
+                printf("Error! SCHED_FIFO priorities must be between %d and %d!\n", lowest, highest);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'A':
+        {
+            long cpus = sysconf(_SC_NPROCESSORS_CONF);
+            cpuNum = 0;
+            for (char *next = optarg, *item; (item = strsep(&next, ",")) != NULL;)
+            {
+                char *end;
+                long cpu = strtol(item, &end, 10);
+                if (end == item || *end != '\0' || cpu < 0 || cpu >= cpus || cpu >= CPU_SETSIZE)
+                {
+                    printf("Error! CPU '%s' does not exist, the CPUs are 0 to %ld!\n", item, cpus - 1);
+                    exit(EXIT_FAILURE);
+                }
+                cpuList = realloc(cpuList, (cpuNum + 1) * sizeof(int));
+                if (cpuList == NULL)
+                {
+                    perror("Failed to allocate the CPU list");
+                    exit(EXIT_FAILURE);
+                }
+                cpuList[cpuNum++] = cpu;
+            }
+            break;
+        }
+        case 'R':
+        case 'B':
+        {
+            unsigned long long size = parseSize(optarg);
+            if (size == 0)
+            {
+                printf("Error! Invalid size '%s'!\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            if (opt == 'R')
+                rotateBytes = size;
+            else
+                diskBudget = size;
+            break;
+        }
+        case 'I':
+            indexIntervalNs = (long long)(atof(optarg) * 1e9);
+            if (indexIntervalNs <= 0)
+            {
+                printf("Error! The interval of the index must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            rotateNs = (long long)(atof(optarg) * 1e9);
+            if (rotateNs <= 0)
+            {
+                printf("Error! The duration of a file must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+        {
+            char *end;
+            long latency = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || latency < 0 || latency > 1000000)
+            {
+                printf("Error! The latency of the simulated buses must be 0 to 1000000 microseconds, not '%s'!\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            simLatencyUs = (int)latency;
+            break;
+        }
+        case 'a':
+            addressNum = 0;
+            for (char *next = optarg, *item; (item = strsep(&next, ",")) != NULL;)
+            {
+                int address = (int)strtol(item, NULL, 0);
+                if ((address != 0x18 && address != 0x19) || addressNum == MAX_BUS_SENSORS)
+                {
+                    printf("Error! Sensor addresses must be 0x18 and/or 0x19!\n");
+                    exit(EXIT_FAILURE);
+                }
+                sensorAddresses[addressNum++] = address;
+            }
+            break;
+        default:
+            exit(EXIT_FAILURE);
+        }
     }
-    // Receive the sensorNum passed via command-line
-    sensorNum = atoi(argv[1]);
-    if (sensorNum < 1 || sensorNum > 4)
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (topologyFile != NULL)
     {
-        printf("Error! Sensor number must be between 1 and 4!\n");
-        exit(EXIT_FAILURE);
+        // The sensors are described by the topology file, only the number of samples may follow
+        loadTopology(topologyFile);
+        argc++;
+        argv--;
+    }
+    else
+    {
+        // Check if at least one command-line argument is passed
+        if (argc < 2)
+        {
+            printf("Error! You must assign bus number!\n");
+            exit(EXIT_FAILURE);
+        }
+        // Receive the busNum passed via command-line
+        busNum = atoi(argv[1]);
+        if (busNum < 1 || busNum > 4)
+        {
+            printf("Error! Bus number must be between 1 and 4!\n");
+            exit(EXIT_FAILURE);
+        }
+        // Bus i is /dev/i2c-i, and sensor i * addressNum + k is at the k-th address of bus i
+        sensorNum = busNum * addressNum;
+        if (addressNum > 1)
+            printf("Warning! The number %d counts buses, not sensors: with %d addresses on each bus from `-a`, it makes %d sensors.\n",
+                   busNum, addressNum, sensorNum);
+        sensorConfigs = calloc(sensorNum, sizeof(SensorConfig));
+        for (int i = 0; i < sensorNum; i++)
+        {
+            sensorConfigs[i] = defaultConfig;
+            snprintf(sensorConfigs[i].bus, sizeof(sensorConfigs[i].bus), "/dev/i2c-%d", i / addressNum);
+            sensorConfigs[i].address = sensorAddresses[i % addressNum];
+        }
     }
     // Check and handle the optional parameter sampleNum
     if (argc > 2)
     {
-        // Receive the number of samples passed via command-line
-        sampleNum = atoi(argv[2]);
-        // It must not be less than the minimum number of samples
-        if (sampleNum < SAMPLE_FREQUENCY)
-            sampleNum = SAMPLE_FREQUENCY;
+        // Receive the number of samples passed via command-line, the minimum of one second of data is applied per sensor
+        sampleNum = atoll(argv[2]);
     }
-    struct stat st;
-    // Check if the file storage directory exists, if not, create it
-    if (!(stat(data_path, &st) == 0 && S_ISDIR(st.st_mode)))
+    for (int i = 0; i < sensorNum; i++)
     {
-        if (mkdir(data_path, 0755) != 0)
+        if (checkSensorConfig(&sensorConfigs[i]) != 0)
         {
-            perror("Failed to create saving directory");
-            return EXIT_FAILURE;
+            printf("Error! Sensor %d: %s does not support %g Hz!\n", i, powerModes[sensorConfigs[i].powerMode].name, sensorConfigs[i].odr);
+            exit(EXIT_FAILURE);
         }
     }
-    printf("Each sensor will collect %d samples in %.2lf seconds.\n", sampleNum, (double)sampleNum / SAMPLE_FREQUENCY);
-}
-
-// Function: Initialize the basic information of each sensor
-void initSensors(pSensor sensorPointer)
-{
-    for (int i = 0; i < sensorNum; i++)
+    // The interrupt sources passed with `-i` are assigned in order to the sensors that have none in the topology file
+    char *nextSpec = irqSpecs;
+    for (int i = 0; i < sensorNum && nextSpec != NULL; i++)
+    {
+        char *spec = strsep(&nextSpec, ",");
+        if (sensorConfigs[i].irq[0] == '\0')
+            snprintf(sensorConfigs[i].irq, sizeof(sensorConfigs[i].irq), "%s", spec);
+    }
+    for (int i = 0; i < sensorNum && acqMode == MODE_IRQ; i++)
     {
-        // Set the index for each sensor
-        (sensorPointer + i)->sensorIndex = i;
-        // Check if each I2C device is successfully opened
-        char i2cPattern[16];
-        snprintf(i2cPattern, sizeof(i2cPattern), "/dev/i2c-%d", i);
-        (sensorPointer + i)->i2cFile = open(i2cPattern, O_RDWR);
-        if ((sensorPointer + i)->i2cFile == -1)
+        if (sensorConfigs[i].irq[0] == '\0')
         {
-            printf("Failed to open /dev/i2c-%d\n", i);
+            printf("Error! The irq mode needs the interrupt source of each sensor, see `-i`!\n");
+            exit(EXIT_FAILURE);
         }
     }
-}
-
-// Function: Write data to a specific register of an I2C device
-int writeRegister(int i2cFile, unsigned char regAddress, unsigned char value)
-{
-    // Pack the register address and data into a 2-byte array `buf`
-    unsigned char buf[2] = {regAddress, value};
-    if (DEBUG_MOD)
+    if (mapOutput && continuous && rotateBytes == 0 && rotateNs == 0)
     {
-        printf("Try to write 0x%02x into register 0x%02x\n", value, regAddress);
+        printf("Error! `-M` needs the length of each file: a number of samples, `-t`, `-R` or `-T`!\n");
+        exit(EXIT_FAILURE);
     }
-    // Try to write the two bytes in `buf` to the I2C device file, and check if the number of bytes written equals sizeof(buf)
-    // If not, it indicates a failure, and an error message is printed before exiting the program
-    if (write(i2cFile, buf, sizeof(buf)) != sizeof(buf))
+    if (lockMemory && mapOutput)
     {
-        perror("Failed to write to I2C device");
-        return 1;
+        printf("Error! `-L` would lock every mapped output file in memory, it cannot be combined with `-M`!\n");
+        exit(EXIT_FAILURE);
     }
-    if (DEBUG_MOD)
+    if (diskBudget > 0 && rotateBytes == 0 && rotateNs == 0)
     {
-        printf("Write successfully!\n");
+        printf("Error! The disk budget `-B` needs `-R` or `-T` to split the acquisition into files!\n");
+        exit(EXIT_FAILURE);
     }
-    return 0;
-}
-
-// Function: Read 1 byte from a specific register of an I2C device
-unsigned char readRegOneByte(int i2cFile, unsigned char regAddress)
-{
-    if (DEBUG_MOD)
-        printf("Try to read 1 byte from register 0x%02x.\n", regAddress);
-    // Try to write the register address `regAddress` to the I2C device file, and check if the number of bytes written equals sizeof(regAddress)
-    // If not, it indicates a failure, and an error message is printed before exiting the program
-    if (write(i2cFile, &regAddress, sizeof(regAddress)) != sizeof(regAddress))
+    if (indexIntervalNs > 0 && outputFormat == FORMAT_ARROW)
     {
-        perror("Failed to write to I2C device");
+        printf("Error! The index `-I` applies to the csv, bin and packed output, an Arrow file is queried by its timestamp column!\n");
         exit(EXIT_FAILURE);
     }
-    unsigned char value;
-    // Try to read 1 byte from the I2C device file into the variable `value`, and check if the number of bytes read equals 1
-    // If not, it indicates a failure, and an error message is printed before exiting the program
-    if (read(i2cFile, &value, sizeof(value)) != sizeof(value))
+    if (pyramidOutput && sessionOutput)
     {
-        perror("Failed to read from I2C device");
+        printf("Error! The pyramids `-P` are built for the files of each sensor, not for a session recording!\n");
         exit(EXIT_FAILURE);
     }
-    if (DEBUG_MOD)
-        printf("Read successfully!\n");
-    return value;
-}
-
-// Function: Read `bufferSize` bytes from a specific register of an I2C device
-void readRegBytes(pSensor arg, unsigned char regAddress, int bufferSize)
-{
-    if (DEBUG_MOD)
-        printf("Try to read %d bytes from register 0x%02x\n", bufferSize, regAddress);
-    if (write(arg->i2cFile, &regAddress, sizeof(regAddress)) != sizeof(regAddress))
+    if (sessionOutput && outputFormat != FORMAT_BIN && outputFormat != FORMAT_PACKED)
     {
-        perror("Failed to write to I2C device");
+        printf("Error! A session recording needs a binary output format, `-o bin` or `-o packed`!\n");
         exit(EXIT_FAILURE);
     }
-    // Try to read `bufferSize` bytes from the I2C device file into the buffer array `msgBuffer`, and check if the number of bytes read equals `bufferSize`
-    // If not, it indicates a failure, and an error message is printed before exiting the program
-    if (bufferSize > 0)
+    // Name all the files of the acquisition after its start, rather than after the moment each bus thread opens its own
+    time_t currentTime = time(NULL);
+    strftime(sessionTime, sizeof(sessionTime), "%Y%m%d_%H%M%S", localtime(&currentTime));
+    struct stat st;
+    // Check if the file storage directory exists, if not, create it
+    if (!(stat(data_path, &st) == 0 && S_ISDIR(st.st_mode)))
     {
-        if (read(arg->i2cFile, arg->msgBuffer, bufferSize) != bufferSize)
+        if (mkdir(data_path, 0755) != 0)
         {
-            perror("Failed to read from I2C device");
+            perror("Failed to create saving directory");
             exit(EXIT_FAILURE);
         }
-        if (DEBUG_MOD)
-            printf("Read successfully!\n");
     }
-    else
+}
+
+// Function: Parse a size in bytes with an optional K, M or G suffix (powers of 1024), return 0 if it is invalid
+unsigned long long parseSize(const char *text)
+{
+    char *end;
+    double size = strtod(text, &end);
+    const char *suffixes = "KMG";
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL)
     {
-        printf("Failed to read %d bytes!\n", bufferSize);
+        for (const char *s = suffixes; s <= suffix; s++)
+            size *= 1024;
+        end++;
     }
+    if (*end != '\0' || size < 1)
+        return 0;
+    return (unsigned long long)size;
 }
 
-// Function: Initialize and configure an I2C device
-int setup(pSensor arg)
+// Function: Apply one `key=value` setting to a sensor configuration, return 0 on success
+// Called with a NULL key, it resets the configuration to the defaults
+int parseSensorSetting(SensorConfig *cfg, const char *key, const char *value)
 {
-    // Use the ioctl function to set the slave address in the I2C communication. If it fails, print an error message and exit the program.
-    if (ioctl(arg->i2cFile, I2C_SLAVE, SENSOR_ADDRESS) < 0)
+    char *end;
+    if (key == NULL)
     {
-        perror("Failed to acquire bus access and/or talk to slave");
-        return 1;
+        memset(cfg, 0, sizeof(*cfg));
+        cfg->address = SENSOR_ADDRESS;
+        cfg->odr = SAMPLE_FREQUENCY;
+        cfg->powerMode = 0;
+        cfg->fullScale = 16;
+        cfg->watermark = 0;
+        cfg->axes = 7;
+        cfg->highOnly = 0;
+        return 0;
     }
-
-    // Configure the accelerometer
-    int ret = 0;
-    ret = writeRegister(arg->i2cFile, CTRL1, 0x97); // CTRL1 - 1600 Hz output data rate, high-performance mode
-    if (ret != 0)
-        return 1;
-    ret = writeRegister(arg->i2cFile, CTRL2, 0x04); // CTRL2 - IF_ADD_INC: Automatically increment register address during multi-byte access
-    if (ret != 0)
-        return 1;
-    ret = writeRegister(arg->i2cFile, FIFO_CTRL, 0xD0); // FIFO_CTRL [FMode2 FMode1 FMode0 FTH4 FTH3 FTH2 FTH1 FTH0], Continuous mode: New samples overwrite old ones when FIFO is full
-    if (ret != 0)
-        return 1;
-    ret = writeRegister(arg->i2cFile, CTRL6, 0x30); // CTRL6 - Full-scale selection: ±16 g
-    if (ret != 0)
+    if (strcmp(key, "bus") == 0)
+        return snprintf(cfg->bus, sizeof(cfg->bus), "%s", value) >= (int)sizeof(cfg->bus);
+    if (strcmp(key, "irq") == 0)
+        return snprintf(cfg->irq, sizeof(cfg->irq), "%s", value) >= (int)sizeof(cfg->irq);
+    if (strcmp(key, "address") == 0)
+    {
+        cfg->address = (int)strtol(value, &end, 0);
+        return *end != '\0' || (cfg->address != 0x18 && cfg->address != 0x19);
+    }
+    if (strcmp(key, "odr") == 0)
+    {
+        cfg->odr = strtod(value, &end);
+        return *end != '\0' || odrCode(cfg->odr) < 0;
+    }
+    if (strcmp(key, "mode") == 0)
+    {
+        for (int i = 0; i < (int)(sizeof(powerModes) / sizeof(powerModes[0])); i++)
+        {
+            if (strcmp(value, powerModes[i].name) == 0)
+            {
+                cfg->powerMode = i;
+                return 0;
+            }
+        }
         return 1;
-
-    // Check the configuration
-    if (DEBUG_MOD)
+    }
+    if (strcmp(key, "fs") == 0)
     {
-        char msg[64];
-        sprintf(msg, "WHO_AM_I: 0x%02x", readRegOneByte(arg->i2cFile, WHO_AM_I));
-        puts(msg);
-        sprintf(msg, "CTRL1: 0x%02x", readRegOneByte(arg->i2cFile, CTRL1));
-        puts(msg);
-        sprintf(msg, "CTRL2: 0x%02x", readRegOneByte(arg->i2cFile, CTRL2));
-        puts(msg);
-        sprintf(msg, "FIFO_CTRL: 0x%02x", readRegOneByte(arg->i2cFile, FIFO_CTRL));
-        puts(msg);
-        sprintf(msg, "CTRL6: 0x%02x", readRegOneByte(arg->i2cFile, CTRL6));
-        puts(msg);
+        cfg->fullScale = (int)strtol(value, &end, 10);
+        return *end != '\0' || fullScaleCode(cfg->fullScale) < 0;
     }
-    return 0;
+    if (strcmp(key, "axes") == 0)
+    {
+        cfg->axes = 0;
+        for (const char *c = value; *c != '\0'; c++)
+        {
+            if (*c < 'x' || *c > 'z')
+                return 1;
+            cfg->axes |= 1 << (*c - 'x');
+        }
+        return cfg->axes == 0;
+    }
+    if (strcmp(key, "bytes") == 0)
+    {
+        cfg->highOnly = strcmp(value, "high") == 0;
+        return !cfg->highOnly && strcmp(value, "full") != 0;
+    }
+    if (strcmp(key, "watermark") == 0)
+    {
+        if (strcmp(value, "auto") == 0)
+        {
+            cfg->watermark = 0;
+            return 0;
+        }
+        cfg->watermark = (int)strtol(value, &end, 10);
+        return *end != '\0' || cfg->watermark < 1 || cfg->watermark >= FIFO_DEPTH;
+    }
+    return 1;
 }
 
-// Function: Loop to read data from an I2C device and write it to a file
-void loop(pSensor arg)
-{
-    // Get the current time
-    time_t currentTime;
-    struct tm *localTime;
-    time(&currentTime);
-    localTime = localtime(&currentTime);
-    // Format the time
-    char formattedTime[16];
-    strftime(formattedTime, sizeof(formattedTime), "%Y%m%d_%H%M%S", localTime);
-    // Use the formatted time as part of the filename
-    char outputFileName[64];
-    snprintf(outputFileName, sizeof(outputFileName), "%s/%s_sensor%d.csv", data_path, formattedTime, arg->sensorIndex);
-    // Open the file for writing
-    FILE *file = fopen(outputFileName, "a");
+// Function: Read the configuration of every sensor from a topology file, one sensor per line
+void loadTopology(const char *path)
+{
+    FILE *file = fopen(path, "r");
     if (file == NULL)
     {
-        perror("Failed to open output file for writing");
+        perror("Failed to open topology file");
         exit(EXIT_FAILURE);
     }
-    // Total number of bytes to read, since each complete data sample contains six bytes, i.e., [X_L, X_H, Y_L, Y_H, Z_L, Z_H]
-    int totalByteNum = sampleNum * 6;
-    // Continue reading as long as there are unread bytes
-    while (totalByteNum > 0)
+    char line[512];
+    int lineNum = 0;
+    sensorNum = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
     {
-        // Check the status register to determine if new data is available
-        if (readRegOneByte(arg->i2cFile, STATUS) & 1 == 1)
+        lineNum++;
+        // Strip the comment, and skip lines without any setting
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0')
+            continue;
+        SensorConfig *grown = realloc(sensorConfigs, (sensorNum + 1) * sizeof(SensorConfig));
+        if (grown == NULL)
         {
-            // Read data into the buffer
-            readRegBytes(arg, OUT_X_L, BUFFER_SIZE);
-            // Combine the high and low bytes
-            short OUT_X = (short)(arg->msgBuffer[1] << 8 | arg->msgBuffer[0]);
-            short OUT_Y = (short)(arg->msgBuffer[3] << 8 | arg->msgBuffer[2]);
-            short OUT_Z = (short)(arg->msgBuffer[5] << 8 | arg->msgBuffer[4]);
-            // Right shift by two bits
-            int dataX = OUT_X >> 2;
-            int dataY = OUT_Y >> 2;
-            int dataZ = OUT_Z >> 2;
-            // Write to the file
-            fprintf(file, "%d,%d,%d\n", dataX, dataY, dataZ);
-            // Update the remaining byte count
-            totalByteNum -= BUFFER_SIZE;
+            perror("Failed to allocate sensors");
+            exit(EXIT_FAILURE);
+        }
+        sensorConfigs = grown;
+        SensorConfig *cfg = &sensorConfigs[sensorNum];
+        *cfg = defaultConfig;
+        char *savePtr;
+        for (char *item = strtok_r(line, " \t", &savePtr); item != NULL; item = strtok_r(NULL, " \t", &savePtr))
+        {
+            char *value = strchr(item, '=');
+            if (value != NULL)
+                *value++ = '\0';
+            if (value == NULL || parseSensorSetting(cfg, item, value) != 0)
+            {
+                printf("Error! Invalid setting '%s' in %s line %d!\n", item, path, lineNum);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (cfg->bus[0] == '\0')
+        {
+            printf("Error! Missing bus in %s line %d!\n", path, lineNum);
+            exit(EXIT_FAILURE);
         }
+        sensorNum++;
+    }
+    fclose(file);
+    if (sensorNum == 0)
+    {
+        printf("Error! No sensor in %s!\n", path);
+        exit(EXIT_FAILURE);
     }
-    fclose(file); // Close the output file
-    printf("\nSensor %d completed!\n", arg->sensorIndex);
 }
 
-// Thread executed by each accelerometer
-void *sensorThread(void *arg)
+// Function: Initialize the basic information of each bus and sensor, return the number of buses
+// Sensors with the same bus path are grouped on one bus, which is opened once and serviced by one thread
+int initSensors(pBus busPointer, pSensor sensorPointer)
 {
-    // Convert the generic pointer to an accelerometer structure pointer
-    pSensor info = (pSensor)arg;
-    // Check if the sensor was initialized correctly before proceeding
-    if (info->i2cFile == -1)
-    {
-        printf("Sensor %d initialization failed. Exiting thread.\n", info->sensorIndex);
-        pthread_exit(NULL);
-    }
-    // Configure the accelerometer parameters
-    int ret = setup(info);
-    if (ret != 0)
+    const BusBackend *backend = simLatencyUs >= 0 ? &simBackend : &i2cDevBackend;
+    int buses = 0;
+    for (int i = 0; i < sensorNum; i++)
     {
-        printf("Sensor %d setup failed. Exiting the thread.\n", info->sensorIndex);
-        pthread_exit(NULL);
-    }
-    // Loop to read data
-    loop(info);
-    // Close the I2C device
-    close(info->i2cFile);
-    // Exit the thread
-    pthread_exit(NULL);
+        pSensor sensor = sensorPointer + i;
+        sensor->sensorIndex = i;
+        sensor->cfg = sensorConfigs[i];
+        sensor->i2cAddress = sensor->cfg.address;
+        sensor->sim = NULL;
+        sensor->event.fd = -1;
+        sensor->attached = 0;
+        sensor->ready = 0;
+        sensor->finished = 0;
+        sensor->out.fd = -1;
+        sensor->out.data = NULL;
+        // The ring is preallocated, nothing is allocated once the acquisition runs
+        sensor->ring = aligned_alloc(_Alignof(SampleRing), sizeof(SampleRing));
+        if (sensor->ring == NULL)
+        {
+            perror("Failed to allocate the sample ring");
+            exit(EXIT_FAILURE);
+        }
+        memset(sensor->ring, 0, sizeof(SampleRing));
+        sensor->pending = 0;
+        // Derive the timing of the sensor from its output data rate
+        sensor->periodNs = (long long)(1e9 / sensor->cfg.odr);
+        sensor->sampleShift = 16 - powerModes[sensor->cfg.powerMode].resolution;
+        if (continuous)
+            sensor->sampleTarget = LLONG_MAX;
+        else if (sampleNum > 0)
+        {
+            // It must not be less than the minimum number of samples, i.e. one second of data
+            sensor->sampleTarget = sampleNum < sensor->cfg.odr ? (long long)(sensor->cfg.odr + 0.5) : sampleNum;
+        }
+        else
+            sensor->sampleTarget = (long long)(duration * sensor->cfg.odr + 0.5);
+        // Work out the recorded axes, and the smallest register span holding their bytes for the per-sample reads of the poll mode
+        char axisNames[4] = "";
+        int first = OUT_Z_H, last = OUT_X_L;
+        sensor->channels = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (!(sensor->cfg.axes & (1 << axis)))
+                continue;
+            axisNames[sensor->channels++] = 'x' + axis;
+            int low = OUT_X_L + 2 * axis + sensor->cfg.highOnly, high = OUT_X_L + 2 * axis + 1;
+            first = low < first ? low : first;
+            last = high > last ? high : last;
+        }
+        sensor->readStart = first;
+        sensor->readLength = last - first + 1;
+        char watermark[12] = "auto";
+        if (sensor->cfg.watermark > 0)
+            snprintf(watermark, sizeof(watermark), "%d", sensor->cfg.watermark);
+        char target[64] = "until stopped";
+        if (!continuous)
+            snprintf(target, sizeof(target), "%lld samples in %.2lf seconds", sensor->sampleTarget, sensor->sampleTarget / sensor->cfg.odr);
+        printf("Sensor %d on %s at 0x%02x: %g Hz, %s, ±%d g, watermark %s, %s axes at %d bits, will collect %s.\n",
+               i, sensor->cfg.bus, sensor->cfg.address, sensor->cfg.odr, powerModes[sensor->cfg.powerMode].name,
+               sensor->cfg.fullScale, watermark, axisNames, sensor->cfg.highOnly ? 8 : powerModes[sensor->cfg.powerMode].resolution, target);
+        // Find the bus of the sensor, or open it if it is the first sensor on that bus
+        pBus bus = NULL;
+        for (int b = 0; b < buses && bus == NULL; b++)
+        {
+            if (strcmp(busPointer[b].path, sensor->cfg.bus) == 0)
+                bus = busPointer + b;
+        }
+        if (bus == NULL)
+        {
+            bus = busPointer + buses;
+            // Check if each I2C device is successfully opened
+            bus->busIndex = buses++;
+            snprintf(bus->path, sizeof(bus->path), "%s", sensor->cfg.bus);
+            bus->sensorCount = 0;
+            bus->backend = backend->open(bus) == 0 ? backend : NULL;
+            if (bus->backend == NULL)
+                printf("Failed to open %s %s\n", backend->name, bus->path);
+        }
+        sensor->bus = bus;
+        if (bus->sensorCount == MAX_BUS_SENSORS)
+        {
+            printf("Error! More than %d sensors on %s!\n", MAX_BUS_SENSORS, bus->path);
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < bus->sensorCount; k++)
+        {
+            if (bus->sensors[k]->i2cAddress == sensor->i2cAddress)
+            {
+                printf("Error! Sensors %d and %d are both at 0x%02x on %s!\n", bus->sensors[k]->sensorIndex, i, sensor->i2cAddress, bus->path);
+                exit(EXIT_FAILURE);
+            }
+        }
+        bus->sensors[bus->sensorCount++] = sensor;
+    }
+    return buses;
+}
+
+// Function: Return the ODR[3:0] bits of CTRL1 selecting an output data rate in Hz, -1 if the rate is not supported
+int odrCode(double odr)
+{
+    // ODR = 0001 is 1.6 Hz in the low-power modes, and 12.5 Hz in high-performance mode like ODR = 0010
+    static const double rates[] = {1.6, 12.5, 25, 50, 100, 200, 400, 800, 1600};
+    for (int i = 0; i < (int)(sizeof(rates) / sizeof(rates[0])); i++)
+    {
+        if (odr == rates[i])
+            return i + 1;
+    }
+    return -1;
+}
+
+// Function: Check that the output data rate is supported in the power mode, return 0 if it is
+int checkSensorConfig(const SensorConfig *cfg)
+{
+    const PowerMode *mode = &powerModes[cfg->powerMode];
+    if (cfg->odr > mode->maxOdr)
+        return 1;
+    // 1.6 Hz only exists in the low-power modes
+    if (cfg->odr == 1.6 && strcmp(mode->name, "hp") == 0)
+        return 1;
+    return 0;
+}
+
+// Function: Return the FS[1:0] bits of CTRL6 selecting a full-scale in g, -1 if the full-scale is not supported
+int fullScaleCode(int fullScale)
+{
+    switch (fullScale)
+    {
+    case 2:
+        return 0;
+    case 4:
+        return 1;
+    case 8:
+        return 2;
+    case 16:
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+// Function: Return the SCL frequency of the adapter behind /dev/i2c-N from its device tree node, 0 if it is unknown
+static long i2cDevClock(const char *path)
+{
+    int adapter;
+    if (sscanf(path, "/dev/i2c-%d", &adapter) != 1)
+        return 0;
+    char node[96];
+    snprintf(node, sizeof(node), "/sys/class/i2c-adapter/i2c-%d/of_node/clock-frequency", adapter);
+    FILE *file = fopen(node, "rb");
+    if (file == NULL)
+        return 0;
+    // Device tree properties are big-endian 32-bit cells
+    unsigned char cell[4];
+    long clock = fread(cell, 1, sizeof(cell), file) == sizeof(cell) ? (long)cell[0] << 24 | cell[1] << 16 | cell[2] << 8 | cell[3] : 0;
+    fclose(file);
+    return clock;
+}
+
+// Function: Open the Linux i2c-dev character device of a bus and probe whether the adapter supports combined transfers
+static int i2cDevOpen(pBus bus)
+{
+    bus->i2cFile = open(bus->path, O_RDWR);
+    if (bus->i2cFile == -1)
+        return 1;
+    // Use combined write-then-read transfers if the adapter supports plain I2C messages, otherwise fall back to write() and read()
+    unsigned long funcs = 0;
+    bus->combinedRead = ioctl(bus->i2cFile, I2C_FUNCS, &funcs) == 0 && (funcs & I2C_FUNC_I2C);
+    bus->selectedAddress = -1;
+    bus->clockHz = i2cDevClock(bus->path);
+    if (DEBUG_MOD)
+        printf("%s uses %s register reads\n", bus->path, bus->combinedRead ? "I2C_RDWR" : "write/read");
+    return 0;
+}
+
+// Function: Select the slave address of a sensor for plain write() and read(), unless it is already selected
+static int i2cDevSelect(pSensor arg)
+{
+    if (arg->bus->selectedAddress == arg->i2cAddress)
+        return 0;
+    // Use the ioctl function to set the slave address in the I2C communication. If it fails, print an error message and exit the program.
+    if (ioctl(arg->bus->i2cFile, I2C_SLAVE, arg->i2cAddress) < 0)
+    {
+        perror("Failed to acquire bus access and/or talk to slave");
+        arg->bus->selectedAddress = -1;
+        return 1;
+    }
+    arg->bus->selectedAddress = arg->i2cAddress;
+    return 0;
+}
+
+// Function: Address a sensor on the I2C bus
+static int i2cDevAttach(pSensor arg)
+{
+    return i2cDevSelect(arg);
+}
+
+// Function: Write `length` bytes, i.e. a register address followed by its values, to the I2C device
+static int i2cDevWrite(pSensor arg, const unsigned char *data, int length)
+{
+    // Sensors sharing the bus may have selected another address in between
+    if (i2cDevSelect(arg) != 0)
+        return 1;
+    // Try to write the bytes to the I2C device file, and check if the number of bytes written equals `length`
+    if (write(arg->bus->i2cFile, data, length) != length)
+    {
+        perror("Failed to write to I2C device");
+        return 1;
+    }
+    return 0;
+}
+
+// Function: Read `length` bytes starting from a specific register of the I2C device
+// When the adapter supports it, the register address is written and the data is read back in a single I2C_RDWR transfer
+// joined by a repeated start, which costs one syscall and no STOP in between. Otherwise a separate write() and read() is used.
+static int i2cDevRead(pSensor arg, unsigned char regAddress, void *buffer, int length)
+{
+    if (arg->bus->combinedRead)
+    {
+        // Every message carries the slave address, so no I2C_SLAVE is needed when switching between sensors
+        struct i2c_msg msgs[2] = {
+            {.addr = arg->i2cAddress, .flags = 0, .len = sizeof(regAddress), .buf = &regAddress},
+            {.addr = arg->i2cAddress, .flags = I2C_M_RD, .len = length, .buf = buffer},
+        };
+        struct i2c_rdwr_ioctl_data transfer = {.msgs = msgs, .nmsgs = 2};
+        // I2C_RDWR returns the number of messages transferred
+        if (ioctl(arg->bus->i2cFile, I2C_RDWR, &transfer) != 2)
+        {
+            perror("Failed to transfer with I2C device");
+            return 1;
+        }
+        return 0;
+    }
+    if (i2cDevSelect(arg) != 0)
+        return 1;
+    // Try to write the register address `regAddress` to the I2C device file, and check if the number of bytes written equals sizeof(regAddress)
+    if (write(arg->bus->i2cFile, &regAddress, sizeof(regAddress)) != sizeof(regAddress))
+    {
+        perror("Failed to write to I2C device");
+        return 1;
+    }
+    // Try to read `length` bytes from the I2C device file into `buffer`, and check if the number of bytes read equals `length`
+    if (read(arg->bus->i2cFile, buffer, length) != length)
+    {
+        perror("Failed to read from I2C device");
+        return 1;
+    }
+    return 0;
+}
+
+// Function: Nothing to release for a sensor on an I2C bus
+static void i2cDevDetach(pSensor arg)
+{
+    (void)arg;
+}
+
+// Function: Close the I2C device
+static void i2cDevClose(pBus bus)
+{
+    close(bus->i2cFile);
+}
+
+const BusBackend i2cDevBackend = {"i2c-dev", i2cDevOpen, i2cDevAttach, i2cDevWrite, i2cDevRead, i2cDevDetach, i2cDevClose};
+
+// Function: Return the output data rate in mHz selected by the CTRL1 value of the simulated device, 0 in power-down
+static long simOutputDataRate(unsigned char ctrl1)
+{
+    // ODR[3:0] of CTRL1, in mHz, for the high-performance mode
+    static const long odrTable[16] = {0, 12500, 12500, 25000, 50000, 100000, 200000, 400000, 800000, 1600000,
+                                      1600000, 1600000, 1600000, 1600000, 1600000, 1600000};
+    int odr = ctrl1 >> 4;
+    // The low-power modes (MODE[1:0] = 00) run at 1.6 Hz with ODR = 0001 and are limited to 200 Hz
+    if ((ctrl1 & 0x0C) == 0)
+    {
+        if (odr == 1)
+            return 1600;
+        if (odrTable[odr] > 200000)
+            return 200000;
+    }
+    return odrTable[odr];
+}
+
+// Function: Produce the samples the simulated device has converted since the last access
+// The number of conversions is derived from the elapsed monotonic time and the configured output data rate,
+// so the FIFO fills at exactly the rate a real sensor would, and overflows if it is not drained in time
+static void simAdvance(SimDevice *dev, const struct timespec *now)
+{
+    long odr = simOutputDataRate(dev->regs[CTRL1]);
+    if (odr == 0)
+        return;
+    long long elapsedNs = (now->tv_sec - dev->odrStart.tv_sec) * 1000000000LL + (now->tv_nsec - dev->odrStart.tv_nsec);
+    long long due = (long long)((__int128)elapsedNs * odr * (1000000 + dev->ppm) / 1000000000000000000LL);
+    long long pending = due - dev->produced;
+    if (pending <= 0)
+        return;
+    // FIFO_CTRL FMode[2:0] = 000 is bypass mode, only the latest sample is kept and nothing counts as an overrun
+    int fifoEnabled = (dev->regs[FIFO_CTRL] & 0xE0) != 0;
+    // Only the newest FIFO_DEPTH samples can survive, older ones are overwritten without being converted
+    if (pending > FIFO_DEPTH)
+    {
+        if (fifoEnabled)
+        {
+            dev->overwritten += pending - FIFO_DEPTH;
+            dev->regs[FIFO_SAMPLES] |= 0x40;
+        }
+        dev->produced += pending - FIFO_DEPTH;
+        pending = FIFO_DEPTH;
+    }
+    for (; pending > 0; pending--)
+    {
+        // A slowly rotating vector plus a little pseudo-random noise, with 1 g on the Z axis
+        dev->waveX -= dev->waveY >> 7;
+        dev->waveY += dev->waveX >> 7;
+        dev->noise = dev->noise * 1103515245u + 12345u;
+        short value[3] = {(short)(dev->waveX >> 16), (short)(dev->waveY >> 16), (short)(512 + ((dev->noise >> 16) & 7) - 4)};
+        if (dev->fifoCount == FIFO_DEPTH || (!fifoEnabled && dev->fifoCount == 1))
+        {
+            // The oldest sample is overwritten
+            dev->fifoHead = (dev->fifoHead + 1) % FIFO_DEPTH;
+            dev->fifoCount--;
+            if (fifoEnabled)
+            {
+                dev->overwritten++;
+                dev->regs[FIFO_SAMPLES] |= 0x40;
+            }
+        }
+        unsigned char *slot = dev->fifo[(dev->fifoHead + dev->fifoCount) % FIFO_DEPTH];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Left-justified 14-bit output as the OUT registers of the real sensor, 12-bit in low-power mode 1
+            unsigned short raw = (unsigned short)(value[axis] << 2);
+            if ((dev->regs[CTRL1] & 0x0F) == 0)
+                raw &= 0xFFF0;
+            slot[2 * axis] = raw & 0xFF;
+            slot[2 * axis + 1] = raw >> 8;
+        }
+        dev->fifoCount++;
+        dev->produced++;
+    }
+}
+
+// Function: Sleep for the time the simulated bus transaction of `bytes` bytes takes
+// Every transaction costs the configured latency plus 9 clock cycles (8 data bits and ACK) per byte at SIM_BUS_CLOCK
+static void simBusDelay(int bytes)
+{
+    struct timespec wakeup;
+    clock_gettime(CLOCK_MONOTONIC, &wakeup);
+    addNanoseconds(&wakeup, simLatencyUs * 1000LL + bytes * 9 * 1000000000LL / SIM_BUS_CLOCK);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR)
+        ;
+}
+
+// Function: Open a simulated bus, its devices are created when they are attached
+static int simOpen(pBus bus)
+{
+    bus->i2cFile = -1;
+    bus->combinedRead = 1;
+    bus->clockHz = SIM_BUS_CLOCK;
+    return 0;
+}
+
+// Function: Create a simulated AIS2IH in power-down mode at the address of the sensor
+static int simAttach(pSensor arg)
+{
+    SimDevice *dev = calloc(1, sizeof(SimDevice));
+    if (dev == NULL)
+        return 1;
+    dev->regs[WHO_AM_I] = 0x44;
+    dev->waveX = 2000 << 16;
+    dev->noise = (unsigned int)arg->sensorIndex + 1;
+    // Like the real parts, every sensor runs a little off its nominal rate, by a few hundred ppm
+    dev->ppm = (arg->sensorIndex * 7 % 11 - 5) * 60;
+    arg->sim = dev;
+    return 0;
+}
+
+// Function: Write a register of the simulated device
+static int simWrite(pSensor arg, const unsigned char *data, int length)
+{
+    SimDevice *dev = arg->sim;
+    simBusDelay(length);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    simAdvance(dev, &now);
+    for (int i = 1; i < length; i++)
+    {
+        unsigned char reg = (data[0] + i - 1) & 0x7F;
+        if (reg == CTRL1)
+        {
+            // Changing the output data rate restarts the conversion timing
+            dev->odrStart = now;
+            dev->produced = 0;
+        }
+        if (reg == FIFO_CTRL)
+        {
+            // Changing the FIFO mode empties the FIFO
+            dev->fifoCount = 0;
+            dev->regs[FIFO_SAMPLES] &= ~0x40;
+        }
+        dev->regs[reg] = data[i];
+    }
+    return 0;
+}
+
+// Function: Read registers of the simulated device, the OUT registers are served from the FIFO
+// The sensor keeps converting during a long burst, so the FIFO is advanced to the time each byte is clocked out, after the
+// register address: a read that drains the FIFO faster than it fills never overruns it, like on the real bus
+static int simRead(pSensor arg, unsigned char regAddress, void *buffer, int length)
+{
+    SimDevice *dev = arg->sim;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    simBusDelay(1 + length);
+    unsigned char *out = buffer;
+    int fifoEnabled = (dev->regs[FIFO_CTRL] & 0xE0) != 0;
+    int outputRead = 0;
+    unsigned char reg = regAddress;
+    for (int i = 0; i < length; i++)
+    {
+        struct timespec byteTime = start;
+        addNanoseconds(&byteTime, simLatencyUs * 1000LL + (2 + i) * 9 * 1000000000LL / SIM_BUS_CLOCK);
+        simAdvance(dev, &byteTime);
+        if (reg >= OUT_X_L && reg <= OUT_Z_H)
+        {
+            outputRead = 1;
+            out[i] = dev->fifoCount > 0 ? dev->fifo[dev->fifoHead][reg - OUT_X_L] : 0;
+            if (reg == OUT_Z_H && dev->fifoCount > 0)
+            {
+                // Reading OUT_Z_H pops the sample, and in FIFO mode the address rolls back to OUT_X_L
+                dev->fifoHead = (dev->fifoHead + 1) % FIFO_DEPTH;
+                dev->fifoCount--;
+                dev->delivered++;
+                dev->overwrittenRead = dev->overwritten;
+                dev->regs[FIFO_SAMPLES] &= ~0x40;
+            }
+        }
+        else if (reg == STATUS)
+            out[i] = (dev->fifoCount > 0 ? 0x01 : 0) | (dev->fifoCount >= (dev->regs[FIFO_CTRL] & 0x1F) ? 0x80 : 0);
+        else if (reg == FIFO_SAMPLES)
+            out[i] = (dev->fifoCount >= (dev->regs[FIFO_CTRL] & 0x1F) ? 0x80 : 0) | (dev->regs[FIFO_SAMPLES] & 0x40) | dev->fifoCount;
+        else
+            out[i] = dev->regs[reg];
+        // IF_ADD_INC in CTRL2 advances the address after each byte
+        if (dev->regs[CTRL2] & 0x04)
+            reg = (fifoEnabled && reg == OUT_Z_H) ? OUT_X_L : ((reg + 1) & 0x7F);
+    }
+    // In bypass mode, any read of the output registers clears DRDY until the next conversion
+    if (!fifoEnabled && outputRead && dev->fifoCount > 0)
+    {
+        dev->fifoCount = 0;
+        dev->delivered++;
+    }
+    return 0;
+}
+
+// Function: Report what the simulated device produced and release it
+// The samples it overwrote before its last sample was read are checked against the ones the acquisition counted,
+// each overrun is estimated within a sample
+static void simDetach(pSensor arg)
+{
+    SimDevice *dev = arg->sim;
+    printf("Simulated sensor %d: %lld samples produced, %lld read, %lld overwritten in the FIFO, %llu counted as lost\n",
+           arg->sensorIndex, dev->produced, dev->delivered, dev->overwritten, arg->ring->overwritten);
+    long long error = (long long)arg->ring->overwritten - dev->overwrittenRead;
+    if (error > (long long)arg->ring->overruns || -error > (long long)arg->ring->overruns)
+        printf("Warning! Sensor %d miscounted its FIFO overruns by %+lld samples.\n", arg->sensorIndex, error);
+    free(dev);
+    arg->sim = NULL;
+}
+
+// Function: Nothing to release for a simulated bus
+static void simClose(pBus bus)
+{
+    (void)bus;
+}
+
+const BusBackend simBackend = {"sim", simOpen, simAttach, simWrite, simRead, simDetach, simClose};
+
+// Function: Write data to a specific register of an I2C device
+int writeRegister(pSensor arg, unsigned char regAddress, unsigned char value)
+{
+    // Pack the register address and data into a 2-byte array `buf`
+    unsigned char buf[2] = {regAddress, value};
+    if (DEBUG_MOD)
+    {
+        printf("Try to write 0x%02x into register 0x%02x\n", value, regAddress);
+    }
+    // Try to write the two bytes in `buf` to the I2C device
+    // If it fails, an error message has been printed by the bus backend
+    if (arg->bus->backend->write(arg, buf, sizeof(buf)) != 0)
+        return 1;
+    if (DEBUG_MOD)
+    {
+        printf("Write successfully!\n");
+    }
+    return 0;
+}
+
+// Function: Read `length` bytes starting from a specific register of an I2C device
+int readRegisters(pSensor arg, unsigned char regAddress, void *buffer, int length)
+{
+    return arg->bus->backend->read(arg, regAddress, buffer, length);
+}
+
+// Function: Read 1 byte from a specific register of an I2C device
+unsigned char readRegOneByte(pSensor arg, unsigned char regAddress)
+{
+    if (DEBUG_MOD)
+        printf("Try to read 1 byte from register 0x%02x.\n", regAddress);
+    unsigned char value;
+    // Try to read 1 byte into the variable `value`
+    // If it fails, an error message has been printed and the program exits
+    if (readRegisters(arg, regAddress, &value, sizeof(value)) != 0)
+        exit(EXIT_FAILURE);
+    if (DEBUG_MOD)
+        printf("Read successfully!\n");
+    return value;
+}
+
+// Function: Read `bufferSize` bytes from a specific register of an I2C device
+void readRegBytes(pSensor arg, unsigned char regAddress, int bufferSize)
+{
+    if (DEBUG_MOD)
+        printf("Try to read %d bytes from register 0x%02x\n", bufferSize, regAddress);
+    // Try to read `bufferSize` bytes into the buffer array `msgBuffer`
+    // If it fails, an error message has been printed and the program exits
+    if (bufferSize > 0)
+    {
+        if (readRegisters(arg, regAddress, arg->msgBuffer, bufferSize) != 0)
+            exit(EXIT_FAILURE);
+        if (DEBUG_MOD)
+            printf("Read successfully!\n");
+    }
+    else
+    {
+        printf("Failed to read %d bytes!\n", bufferSize);
+    }
+}
+
+// Function: Consume the line events of a GPIO character device
+static int consumeGpioEvent(EventSource *source)
+{
+    struct gpioevent_data events[16];
+    if (read(source->fd, events, sizeof(events)) < (ssize_t)sizeof(events[0]))
+    {
+        perror("Failed to read GPIO line event");
+        return 1;
+    }
+    return 0;
+}
+
+// Function: Consume whatever was written to a plain file descriptor (pipe, eventfd or timerfd)
+static int consumeFdEvent(EventSource *source)
+{
+    uint64_t scratch[8];
+    if (read(source->fd, scratch, sizeof(scratch)) <= 0)
+    {
+        perror("Failed to read interrupt event");
+        return 1;
+    }
+    return 0;
+}
+
+// Function: Open the interrupt source described by `spec`, i.e. "gpiochipN:LINE", "fd:N" or "timer"
+// `periodNs` is the expected time between two FIFO threshold events, used by the timer test double
+int openEventSource(EventSource *source, const char *spec, long long periodNs)
+{
+    source->fd = -1;
+    if (strncmp(spec, "fd:", 3) == 0)
+    {
+        // Test double: the events come from a descriptor inherited from the parent process
+        source->fd = atoi(spec + 3);
+        source->consume = consumeFdEvent;
+        return fcntl(source->fd, F_GETFD) == -1 ? 1 : 0;
+    }
+    if (strcmp(spec, "timer") == 0)
+    {
+        // Test double: a timer that fires every `periodNs`, when a watermark's worth of samples would be ready
+        source->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (source->fd == -1)
+            return 1;
+        struct itimerspec period = {
+            .it_interval = {.tv_sec = periodNs / 1000000000LL, .tv_nsec = periodNs % 1000000000LL},
+            .it_value = {.tv_sec = periodNs / 1000000000LL, .tv_nsec = periodNs % 1000000000LL},
+        };
+        source->consume = consumeFdEvent;
+        return timerfd_settime(source->fd, 0, &period, NULL) == 0 ? 0 : 1;
+    }
+    // Real hardware: request rising edge events on a line of a GPIO character device
+    char chipPath[64];
+    unsigned int line;
+    const char *colon = strchr(spec, ':');
+    if (colon == NULL || sscanf(colon + 1, "%u", &line) != 1)
+    {
+        printf("Error! Invalid interrupt source '%s'!\n", spec);
+        return 1;
+    }
+    snprintf(chipPath, sizeof(chipPath), "%s%.*s", spec[0] == '/' ? "" : "/dev/", (int)(colon - spec), spec);
+    int chipFile = open(chipPath, O_RDWR | O_CLOEXEC);
+    if (chipFile == -1)
+    {
+        perror("Failed to open GPIO chip");
+        return 1;
+    }
+    struct gpioevent_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffset = line;
+    request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    request.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+    strncpy(request.consumer_label, "AIS2IH INT1", sizeof(request.consumer_label) - 1);
+    int ret = ioctl(chipFile, GPIO_GET_LINEEVENT_IOCTL, &request);
+    close(chipFile); // The line event file descriptor stays valid on its own
+    if (ret < 0)
+    {
+        perror("Failed to request GPIO line events");
+        return 1;
+    }
+    source->fd = request.fd;
+    source->consume = consumeGpioEvent;
+    return 0;
+}
+
+// Function: Close an interrupt source, if it is open
+void closeEventSource(EventSource *source)
+{
+    if (source->fd != -1)
+        close(source->fd);
+    source->fd = -1;
+}
+
+// Function: Wait up to `timeoutMs` for an event of any source, return the number of events, 0 on timeout, -1 on error
+int waitEvents(EventSource *sources[], int count, int timeoutMs)
+{
+    struct pollfd pfds[MAX_BUS_SENSORS];
+    for (int i = 0; i < count; i++)
+    {
+        pfds[i].fd = sources[i]->fd;
+        pfds[i].events = POLLIN;
+    }
+    int ret = poll(pfds, count, timeoutMs);
+    if (ret < 0)
+        return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < count; i++)
+    {
+        if ((pfds[i].revents & POLLIN) && sources[i]->consume(sources[i]) != 0)
+            return -1;
+    }
+    return ret;
+}
+
+// Function: Order two times for qsort
+static int compareTimes(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Function: Return the median time in nanoseconds of PLAN_REPEAT reads of `length` bytes from a register, -1 on error
+long long timeRead(pSensor arg, unsigned char regAddress, int length)
+{
+    long long times[PLAN_REPEAT];
+    // The first read is not timed, it may include waking up the adapter
+    if (readRegisters(arg, regAddress, arg->msgBuffer, length) != 0)
+        return -1;
+    for (int i = 0; i < PLAN_REPEAT; i++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (readRegisters(arg, regAddress, arg->msgBuffer, length) != 0)
+            return -1;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        times[i] = diffNanoseconds(&end, &start);
+    }
+    // The median is not thrown off by the reads that got descheduled
+    qsort(times, PLAN_REPEAT, sizeof(times[0]), compareTimes);
+    return times[PLAN_REPEAT / 2];
+}
+
+// Function: Return the expected time in nanoseconds of a read of `length` bytes on a profiled bus
+double readCostNs(pBus bus, int length)
+{
+    return bus->fixedCostNs + bus->byteCostNs * length;
+}
+
+// Function: Profile a bus and size the watermarks of its sensors, return 1 if the bus cannot keep up with them
+// A FIFO drain costs a read of FIFO_SAMPLES plus a burst read of the samples, and all sensors of a bus are drained back-to-back,
+// so every FIFO must be able to hold the samples produced while the whole bus is drained, plus PLAN_MARGIN_US of scheduling latency
+int planBus(pBus arg)
+{
+    // Address the sensors, the ones that do not answer are skipped
+    pSensor sensors[MAX_BUS_SENSORS];
+    int count = 0;
+    for (int i = 0; i < arg->sensorCount; i++)
+    {
+        if (arg->backend->attach(arg->sensors[i]) != 0)
+        {
+            printf("Sensor %d cannot be addressed. Skipping it.\n", arg->sensors[i]->sensorIndex);
+            continue;
+        }
+        arg->sensors[i]->attached = 1;
+        sensors[count++] = arg->sensors[i];
+    }
+    if (count == 0)
+        return 0;
+
+    // Time short and full-FIFO reads of the output registers. The sensor is powered down with its FIFO enabled,
+    // so the address rolls over at OUT_Z_H and the reads neither leave the output registers nor consume samples.
+    long long shortNs = -1, longNs = -1;
+    if (writeRegister(sensors[0], CTRL1, 0x00) == 0 && writeRegister(sensors[0], CTRL2, 0x04) == 0 &&
+        writeRegister(sensors[0], FIFO_CTRL, 0xC0) == 0)
+    {
+        shortNs = timeRead(sensors[0], OUT_X_L, 1);
+        longNs = timeRead(sensors[0], OUT_X_L, FIFO_DEPTH * BUFFER_SIZE);
+    }
+    if (shortNs < 0 || longNs < 0)
+    {
+        printf("Bus %s could not be profiled, its sensors keep their watermarks.\n", arg->path);
+        for (int i = 0; i < count; i++)
+            sensors[i]->cfg.watermark = sensors[i]->cfg.watermark > 0 ? sensors[i]->cfg.watermark : FIFO_WATERMARK;
+        openBusEvents(arg, sensors, count);
+        return 0;
+    }
+    arg->byteCostNs = longNs > shortNs ? (double)(longNs - shortNs) / (FIFO_DEPTH * BUFFER_SIZE - 1) : 0;
+    arg->fixedCostNs = shortNs - arg->byteCostNs;
+    if (arg->clockHz > 0)
+        printf("Bus %s: %ld kHz, a register read takes %.0f us + %.1f us per byte (%.1f us per byte on the wire)\n", arg->path,
+               arg->clockHz / 1000, arg->fixedCostNs / 1000, arg->byteCostNs / 1000, 9e6 / arg->clockHz);
+    else
+        printf("Bus %s: unknown clock, a register read takes %.0f us + %.1f us per byte\n", arg->path,
+               arg->fixedCostNs / 1000, arg->byteCostNs / 1000);
+
+    double marginNs = PLAN_MARGIN_US * 1000.0;
+    double busyNs = 0;  // Time to service every sensor of the bus once
+    double slackNs = 0; // Smallest time a sensor can wait on top of `busyNs` before its FIFO overflows
+    double load = 0;    // Fraction of the bus time spent reading
+    if (acqMode == MODE_POLL)
+    {
+        // Every sensor is visited once per round with a STATUS read and a sample read, and must be visited once per sample period
+        for (int i = 0; i < count; i++)
+        {
+            sensors[i]->cfg.watermark = sensors[i]->cfg.watermark > 0 ? sensors[i]->cfg.watermark : FIFO_WATERMARK;
+            busyNs += readCostNs(arg, 1) + readCostNs(arg, sensors[i]->readLength);
+        }
+        slackNs = 1e18;
+        for (int i = 0; i < count; i++)
+        {
+            load += (readCostNs(arg, 1) + readCostNs(arg, sensors[i]->readLength)) / sensors[i]->periodNs;
+            if (sensors[i]->periodNs - busyNs < slackNs)
+                slackNs = sensors[i]->periodNs - busyNs;
+        }
+        // Polling does not sleep, so there is no scheduling latency to absorb
+        marginNs = 0;
+    }
+    else if (acqMode == MODE_BURST)
+    {
+        // The bus is drained, then sleeps for half a FIFO of the fastest sensor, so every FIFO fills for the whole cycle
+        double sleepNs = FIFO_DEPTH / 2 * sensors[0]->periodNs, rate = 0;
+        for (int i = 0; i < count; i++)
+        {
+            sensors[i]->cfg.watermark = sensors[i]->cfg.watermark > 0 ? sensors[i]->cfg.watermark : FIFO_WATERMARK;
+            if (FIFO_DEPTH / 2 * sensors[i]->periodNs < sleepNs)
+                sleepNs = FIFO_DEPTH / 2 * sensors[i]->periodNs;
+            rate += arg->byteCostNs * BUFFER_SIZE / sensors[i]->periodNs;
+            busyNs += readCostNs(arg, 1) + readCostNs(arg, 1);
+        }
+        // The samples read in one cycle grow with the cycle: cycle = sleep + busy + rate * cycle
+        double cycleNs = rate < 1 ? (sleepNs + busyNs) / (1 - rate) : 1e18;
+        busyNs = cycleNs - sleepNs;
+        load = busyNs / cycleNs;
+        slackNs = 1e18;
+        for (int i = 0; i < count; i++)
+        {
+            if (FIFO_DEPTH * sensors[i]->periodNs - cycleNs < slackNs)
+                slackNs = FIFO_DEPTH * sensors[i]->periodNs - cycleNs;
+        }
+    }
+    else
+    {
+        // Start the automatic watermarks from the deepest threshold, i.e. the fewest transactions,
+        // and lower them until the FIFO of every sensor has room for a drain of the whole bus plus the margin
+        int automatic[MAX_BUS_SENSORS];
+        for (int i = 0; i < count; i++)
+        {
+            automatic[i] = sensors[i]->cfg.watermark == 0;
+            if (automatic[i])
+                sensors[i]->cfg.watermark = FIFO_DEPTH - 1;
+        }
+        for (int changed = 1; changed;)
+        {
+            changed = 0;
+            busyNs = 0;
+            for (int i = 0; i < count; i++)
+                busyNs += readCostNs(arg, 1) + readCostNs(arg, sensors[i]->cfg.watermark * BUFFER_SIZE);
+            for (int i = 0; i < count; i++)
+            {
+                if (automatic[i] && sensors[i]->cfg.watermark > 1 &&
+                    (FIFO_DEPTH - sensors[i]->cfg.watermark) * sensors[i]->periodNs < busyNs + marginNs)
+                {
+                    sensors[i]->cfg.watermark--;
+                    changed = 1;
+                }
+            }
+        }
+        slackNs = 1e18;
+        for (int i = 0; i < count; i++)
+        {
+            int watermark = sensors[i]->cfg.watermark;
+            load += (readCostNs(arg, 1) + readCostNs(arg, watermark * BUFFER_SIZE)) / (watermark * sensors[i]->periodNs);
+            if ((FIFO_DEPTH - watermark) * sensors[i]->periodNs - busyNs < slackNs)
+                slackNs = (FIFO_DEPTH - watermark) * sensors[i]->periodNs - busyNs;
+        }
+    }
+    openBusEvents(arg, sensors, count);
+    printf("  Bus load %.0f%%, a pass over the bus takes %.2f ms, the tightest FIFO has %.2f ms left\n", load * 100, busyNs / 1e6, slackNs / 1e6);
+    if (load >= 1 || slackNs < 0)
+    {
+        printf("Error! Bus %s cannot keep up with its sensors, lower the output data rates or move sensors to other buses.\n", arg->path);
+        return 1;
+    }
+    if (load > PLAN_MAX_LOAD || slackNs < marginNs)
+        printf("Warning! Bus %s is close to its limits, samples may be lost when the thread is descheduled.\n", arg->path);
+    return 0;
+}
+
+// Function: Print the watermark of every addressed sensor of a bus, and open its interrupt source in irq mode
+// A sensor whose interrupt source cannot be opened is released, it would never be drained
+void openBusEvents(pBus arg, pSensor sensors[], int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        printf("  Sensor %d: watermark %d, %.0f samples per second\n", sensors[i]->sensorIndex, sensors[i]->cfg.watermark, sensors[i]->cfg.odr);
+        // The timer test double of the irq mode fires at the final watermark
+        if (acqMode == MODE_IRQ && openEventSource(&sensors[i]->event, sensors[i]->cfg.irq, sensors[i]->cfg.watermark * sensors[i]->periodNs) != 0)
+        {
+            printf("Failed to open the interrupt source of sensor %d\n", sensors[i]->sensorIndex);
+            arg->backend->detach(sensors[i]);
+            sensors[i]->attached = 0;
+        }
+    }
+}
+
+// Function: Initialize and configure an I2C device
+int setup(pSensor arg)
+{
+    // Configure the accelerometer, it was addressed on its bus by the planner
+    // It stays in power-down until startSensor sets its output data rate, so that all sensors start together
+    int ret = 0;
+    arg->firstRawNs = arg->firstRealtimeNs = 0;
+    ret = writeRegister(arg, CTRL1, powerModes[arg->cfg.powerMode].ctrl1Bits); // CTRL1 [ODR3 ODR2 ODR1 ODR0 MODE1 MODE0 LP_MODE1 LP_MODE0], ODR 0000: power-down
+    if (ret != 0)
+        return 1;
+    ret = writeRegister(arg, CTRL2, 0x04); // CTRL2 - IF_ADD_INC: Automatically increment register address during multi-byte access
+    if (ret != 0)
+        return 1;
+    // FIFO_CTRL [FMode2 FMode1 FMode0 FTH4 FTH3 FTH2 FTH1 FTH0], Continuous mode: New samples overwrite old ones when FIFO is full
+    // Partial reads of the poll mode would never release a FIFO slot, so it reads the output registers directly in bypass mode
+    int bypass = acqMode == MODE_POLL && arg->readLength < BUFFER_SIZE;
+    ret = writeRegister(arg, FIFO_CTRL, (bypass ? 0x00 : 0xC0) | arg->cfg.watermark);
+    if (ret != 0)
+        return 1;
+    ret = writeRegister(arg, CTRL6, fullScaleCode(arg->cfg.fullScale) << 4); // CTRL6 [BW_FILT1 BW_FILT0 FS1 FS0 FDS LOW_NOISE - -], e.g. 0x30: Full-scale selection: ±16 g
+    if (ret != 0)
+        return 1;
+    if (acqMode == MODE_IRQ)
+    {
+        ret = writeRegister(arg, CTRL4_INT1_PAD_CTRL, 0x02); // CTRL4_INT1_PAD_CTRL - INT1_FTH: Route the FIFO threshold flag to the INT1 pin
+        if (ret != 0)
+            return 1;
+        ret = writeRegister(arg, CTRL7, 0x20); // CTRL7 - INTERRUPTS_ENABLE: Enable the interrupt signals
+        if (ret != 0)
+            return 1;
+    }
+
+    // Check the configuration
+    if (DEBUG_MOD)
+    {
+        char msg[64];
+        sprintf(msg, "WHO_AM_I: 0x%02x", readRegOneByte(arg, WHO_AM_I));
+        puts(msg);
+        sprintf(msg, "CTRL1: 0x%02x", readRegOneByte(arg, CTRL1));
+        puts(msg);
+        sprintf(msg, "CTRL2: 0x%02x", readRegOneByte(arg, CTRL2));
+        puts(msg);
+        sprintf(msg, "FIFO_CTRL: 0x%02x", readRegOneByte(arg, FIFO_CTRL));
+        puts(msg);
+        sprintf(msg, "CTRL6: 0x%02x", readRegOneByte(arg, CTRL6));
+        puts(msg);
+    }
+    return 0;
+}
+
+// Function: Set the output data rate of a sensor configured by setup, which starts its conversions, and record the time of its first sample
+int startSensor(pSensor arg)
+{
+    if (writeRegister(arg, CTRL1, odrCode(arg->cfg.odr) << 4 | powerModes[arg->cfg.powerMode].ctrl1Bits) != 0) // e.g. 0x97: 1600 Hz output data rate, high-performance mode
+        return 1;
+    // The first conversion completes one period after the write, which took effect between the two reads of the clocks
+    struct timespec raw, realtime;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    arg->firstRawNs = raw.tv_sec * 1000000000LL + raw.tv_nsec + arg->periodNs;
+    arg->firstRealtimeNs = realtime.tv_sec * 1000000000LL + realtime.tv_nsec + arg->periodNs;
+    arg->newestRawNs = arg->firstRawNs - arg->periodNs;
+    arg->leftInFifo = 0;
+    arg->overrunHidden = 0;
+    return 0;
+}
+
+// Function: Convert the raw samples of a block into `out`, return the number of values per sample
+// Sample i starts `i * rawStride` bytes into the block and its first byte is register `rawStart`
+int convertSamples(pSensor arg, const RingBlock *block, short *out)
+{
+    for (int i = 0; i < block->count; i++)
+    {
+        // Offset in `raw` of register 0 of the sample, which can be negative since the sample starts at `rawStart`.
+        // Only the offsets of the bytes read are turned into pointers.
+        int sample = i * block->rawStride - block->rawStart;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (!(arg->cfg.axes & (1 << axis)))
+                continue;
+            int low = sample + OUT_X_L + 2 * axis;
+            if (arg->cfg.highOnly)
+            {
+                // The high byte alone is the 8-bit two's complement sample, the low byte may not have been read
+                *out++ = (signed char)block->raw[low + 1];
+                continue;
+            }
+            // Combine the high and low bytes
+            short value = (short)(block->raw[low + 1] << 8 | (unsigned char)block->raw[low]);
+            // Right shift by two bits for 14-bit data, or by four bits for 12-bit data
+            *out++ = value >> arg->sampleShift;
+        }
+    }
+    return arg->channels;
+}
+
+// Function: Queue `count` raw samples of `msgBuffer` for the writer thread, each `rawStride` bytes long and starting at register `rawStart`
+// The samples are appended to the block at the head of the ring, which is only handed over by publishSamples.
+// If the writer thread fell RING_BLOCKS blocks behind, the samples are dropped instead of waiting for storage.
+void pushSamples(pSensor arg, unsigned char rawStart, int rawStride, int count, int newer, long long reportedRawNs)
+{
+    SampleRing *ring = arg->ring;
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    RingBlock *block = &ring->blocks[head % RING_BLOCKS];
+    // Hand over the block being filled if the samples do not fit in it
+    if (arg->pending > 0 && (block->rawStart != rawStart || block->rawStride != rawStride ||
+                             (arg->pending + count) * rawStride > (int)sizeof(block->raw)))
+    {
+        publishSamples(arg);
+        block = &ring->blocks[++head % RING_BLOCKS];
+    }
+    if (arg->pending == 0)
+    {
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= RING_BLOCKS)
+        {
+            ring->dropped += count;
+            arg->written += count;
+            return;
+        }
+        block->firstSample = arg->written;
+        block->rawStart = rawStart;
+        block->rawStride = rawStride;
+    }
+    memcpy(block->raw + arg->pending * rawStride, arg->msgBuffer, count * rawStride);
+    arg->pending += count;
+    block->count = arg->pending;
+    // The block is dated by its last sample on every clock: the newest one when the FIFO level was read at `reportedRawNs`,
+    // or just now if 0, earlier if `newer` samples followed it in the FIFO and were left there. The samples converted during
+    // a long burst read do not delay the date of the block.
+    struct timespec now, raw, realtime;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    long long ageNs = newer * arg->periodNs;
+    if (reportedRawNs != 0)
+        ageNs += raw.tv_sec * 1000000000LL + raw.tv_nsec - reportedRawNs;
+    block->timestampNs = now.tv_sec * 1000000000LL + now.tv_nsec - ageNs;
+    block->rawNs = raw.tv_sec * 1000000000LL + raw.tv_nsec - ageNs;
+    block->realtimeNs = realtime.tv_sec * 1000000000LL + realtime.tv_nsec - ageNs;
+    arg->written += count;
+}
+
+// Function: Hand the block being filled over to the writer thread
+void publishSamples(pSensor arg)
+{
+    if (arg->pending == 0)
+        return;
+    SampleRing *ring = arg->ring;
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    arg->pending = 0;
+    unsigned waiting = head - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (waiting > ring->highWater)
+        ring->highWater = waiting;
+}
+
+// Function: Tell the writer thread that a sensor pushed its last samples, it then closes the output file
+void closeOutput(pSensor arg)
+{
+    publishSamples(arg);
+    atomic_store_explicit(&arg->ring->closed, 1, memory_order_release);
+}
+
+// Function: Return where up to `length` bytes can be appended to an output file, making room for them
+char *outputReserve(OutputFile *out, size_t length)
+{
+    if (out->used + length <= out->size)
+        return out->data + out->used;
+    if (!out->mapped)
+    {
+        flushOutput(out);
+        return out->data;
+    }
+    // Only reached if the capture outgrows the preallocation, e.g. after dropped samples split the blocks
+    size_t size = out->size * 2 > out->used + length ? out->size * 2 : out->used + length;
+    if (fallocate(out->fd, 0, out->size, size - out->size) != 0 && ftruncate(out->fd, size) != 0)
+    {
+        perror("Failed to grow the mapped output file");
+        exit(EXIT_FAILURE);
+    }
+    char *data = mremap(out->data, out->size, size, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to grow the output file mapping");
+        exit(EXIT_FAILURE);
+    }
+    out->data = data;
+    out->size = size;
+    return out->data + out->used;
+}
+
+// Function: Append the `length` bytes stored at the address returned by outputReserve
+void outputCommit(OutputFile *out, size_t length)
+{
+    out->used += length;
+    out->length += length;
+    // Start writing back the dirty pages of a mapping in large ranges, without waiting for them
+    if (out->mapped && out->used - out->flushed >= MAP_FLUSH_BYTES)
+    {
+        size_t start = out->flushed & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+        msync(out->data + start, out->used - start, MS_ASYNC);
+        out->flushed = out->used;
+    }
+}
+
+// Function: Append `length` bytes to an output file
+void outputWrite(OutputFile *out, const void *data, size_t length)
+{
+    memcpy(outputReserve(out, length), data, length);
+    outputCommit(out, length);
+}
+
+// Function: Write the buffered bytes of an output file in a single write(), unless the kernel takes them in parts
+void flushOutput(OutputFile *out)
+{
+    for (size_t done = 0; done < out->used;)
+    {
+        ssize_t ret = write(out->fd, out->data + done, out->used - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+        {
+            perror("Failed to write output file");
+            exit(EXIT_FAILURE);
+        }
+        done += ret;
+    }
+    out->used = 0;
+}
+
+// Function: Flush and close an output file, a mapped file is truncated to the bytes written
+void closeFile(OutputFile *out)
+{
+    if (!out->mapped)
+    {
+        flushOutput(out);
+        free(out->data);
+    }
+    else
+    {
+        msync(out->data, out->used, MS_ASYNC);
+        munmap(out->data, out->size);
+        if (ftruncate(out->fd, out->used) != 0)
+            perror("Failed to truncate the mapped output file");
+    }
+    close(out->fd);
+    out->data = NULL;
+    out->fd = -1;
+    if (out->index != NULL)
+    {
+        if (fclose(out->index) != 0)
+            perror("Failed to write the index");
+        out->index = NULL;
+    }
+    if (out->times != NULL)
+    {
+        // The header is rewritten with the last estimate of the sample periods
+        rewind(out->times);
+        writeTimeHeader(out, 1);
+        if (fclose(out->times) != 0)
+            perror("Failed to write the time file");
+        out->times = NULL;
+    }
+}
+
+// Function: Write a record of `size` bytes to a time file or an index, a stream reports its first failure with `message`
+void writeRecord(FILE *file, const void *record, size_t size, const char *message)
+{
+    int failed = ferror(file);
+    if (fwrite(record, size, 1, file) != 1 && !failed)
+        perror(message);
+}
+
+// Function: Open the index of an output file, FILE.idx, and write its header, see `-I`
+// `arg` is the sensor of the file, or NULL for the session recording, whose blocks carry their sensor and their time
+void openIndex(OutputFile *out, pSensor arg)
+{
+    out->index = NULL;
+    out->indexNextNs = 0;
+    if (indexIntervalNs == 0)
+        return;
+    char path[sizeof(out->path) + 4];
+    snprintf(path, sizeof(path), "%s.idx", out->path);
+    out->index = fopen(path, "wb");
+    if (out->index == NULL)
+    {
+        perror("Failed to open the index");
+        exit(EXIT_FAILURE);
+    }
+    IndexHeader header = {.magic = INDEX_MAGIC, .version = RECORDING_VERSION, .headerSize = sizeof(IndexHeader)};
+    header.intervalMs = indexIntervalNs / 1000000;
+    if (arg != NULL)
+    {
+        header.odrMilliHz = (uint32_t)(arg->cfg.odr * 1000 + 0.5);
+        header.channels = arg->channels;
+    }
+    struct timespec monotonic;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    header.startMonotonicNs = monotonic.tv_sec * 1000000000LL + monotonic.tv_nsec;
+    writeRecord(out->index, &header, sizeof(header), "Failed to write the index");
+}
+
+// Function: Open the time file of an output file, FILE.time, for the `count` sensors of the file, all of them in a session recording
+// The first file of each sensor is opened before the sensors are started, so the header is only written with the first record
+void openTimes(OutputFile *out, pSensor sensors, int count)
+{
+    char path[sizeof(out->path) + 5];
+    snprintf(path, sizeof(path), "%s.time", out->path);
+    out->batches = 0;
+    out->timeSensors = sensors;
+    out->timeSensorCount = count;
+    out->times = fopen(path, "wb");
+    if (out->times == NULL)
+    {
+        perror("Failed to open the time file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function: Write the header of a time file, with the time of the first sample of each of its sensors, and their measured
+// period if the file is `closing`. It is written with the first record, and rewritten when the file is closed.
+void writeTimeHeader(OutputFile *out, int closing)
+{
+    TimeHeader header = {.magic = TIME_MAGIC, .version = RECORDING_VERSION, .sensorCount = out->timeSensorCount};
+    header.headerSize = sizeof(TimeHeader) + out->timeSensorCount * sizeof(TimeStart);
+    if (!sessionOutput)
+        header.odrMilliHz = (uint32_t)(out->timeSensors[0].cfg.odr * 1000 + 0.5);
+    writeRecord(out->times, &header, sizeof(header), "Failed to write the time file");
+    for (int i = 0; i < out->timeSensorCount; i++)
+    {
+        pSensor sensor = &out->timeSensors[i];
+        TimeStart start = {.firstRawNs = sensor->firstRawNs, .firstRealtimeNs = sensor->firstRealtimeNs};
+        if (closing && out->batches > 0)
+            start.periodFs = (uint64_t)(sensor->estimatedPeriodNs * 1e6 + 0.5);
+        writeRecord(out->times, &start, sizeof(start), "Failed to write the time file");
+    }
+}
+
+// Function: Update the sample period of a sensor with a block, then record the times of the block in the time file
+void writeTimes(OutputFile *out, pSensor arg, const RingBlock *block)
+{
+    // The period is the slope of the least-squares line through the CLOCK_MONOTONIC_RAW read time of every block against the
+    // index of its last sample, the nominal one until the blocks span a second. The constant part of the read latency goes
+    // into the intercept and the jitter of the reads averages out. The sums are updated around the running means, so they
+    // keep their precision over days of samples, and each block costs a few operations.
+    // The size of a FIFO overrun is estimated within a sample, so every gap starts a new run of blocks with its own intercept:
+    // the runs share the slope, and a miscounted gap shifts the sample indexes after it without bending the fit.
+    // An overrun that the FIFO did not flag is only found by the next drain, after the block read behind it, whose samples
+    // are then later than their indexes. So each block enters the fit with the next one, and is left out if a gap follows it.
+    if (arg->anchorRawNs == 0)
+    {
+        arg->anchorRawNs = block->rawNs;
+        arg->estimatedPeriodNs = arg->periodNs;
+    }
+    else if (block->firstSample > arg->nextSample)
+    {
+        arg->fitWaiting = 0;
+        if (arg->fitCount > 0)
+        {
+            arg->fitBlocks += arg->fitCount;
+            arg->fitRuns++;
+            arg->fitPooledSamples += arg->fitSampleSquares;
+            arg->fitPooledProducts += arg->fitProducts;
+            arg->fitPooledTimes += arg->fitTimeSquares;
+            arg->fitCount = arg->fitMeanSample = arg->fitMeanNs = arg->fitSampleSquares = arg->fitProducts = arg->fitTimeSquares = 0;
+        }
+    }
+    double sample = arg->fitNextSample, timeNs = arg->fitNextNs;
+    int waiting = arg->fitWaiting;
+    arg->fitNextSample = block->firstSample + block->count - 1;
+    arg->fitNextNs = block->rawNs - arg->anchorRawNs;
+    arg->fitWaiting = 1;
+    if (waiting)
+    {
+        double sampleDeviation = sample - arg->fitMeanSample, timeDeviation = timeNs - arg->fitMeanNs;
+        arg->fitCount++;
+        arg->fitMeanSample += sampleDeviation / arg->fitCount;
+        arg->fitMeanNs += timeDeviation / arg->fitCount;
+        arg->fitSampleSquares += sampleDeviation * (sample - arg->fitMeanSample);
+        arg->fitProducts += sampleDeviation * (timeNs - arg->fitMeanNs);
+        arg->fitTimeSquares += timeDeviation * (timeNs - arg->fitMeanNs);
+    }
+    double samples = arg->fitPooledSamples + arg->fitSampleSquares, products = arg->fitPooledProducts + arg->fitProducts;
+    double freedom = arg->fitBlocks + arg->fitCount - arg->fitRuns - 2;
+    if (waiting && timeNs >= 1e9 && samples > 0 && freedom > 0)
+    {
+        // The residuals of a steady rate are the jitter of the read times. An index slip that the runs do not absorb shows
+        // as residuals of whole sample periods, and the period is then not trusted. A read only tells the newest sample to
+        // within a period, and paced reads follow the nominal rate without averaging this out, so the error also counts
+        // one period over the span of the fit.
+        double slope = products / samples;
+        double residuals = arg->fitPooledTimes + arg->fitTimeSquares - slope * products;
+        double deviationNs = residuals > 0 ? sqrt(residuals / freedom) : 0;
+        double jitterPpm = deviationNs / sqrt(samples) / slope * 1e6, resolutionPpm = arg->periodNs / timeNs * 1e6;
+        arg->periodErrorPpm = sqrt(jitterPpm * jitterPpm + resolutionPpm * resolutionPpm);
+        arg->fitDeviation = deviationNs / arg->periodNs;
+        arg->estimatedPeriodNs = arg->fitDeviation > FIT_MAX_DEVIATION ? arg->periodNs : slope;
+    }
+    TimeRecord record = {.firstSample = block->firstSample, .sampleCount = block->count, .sensor = arg->sensorIndex};
+    if (out->batches == 0)
+        writeTimeHeader(out, 0);
+    record.periodNs = (uint32_t)(arg->estimatedPeriodNs + 0.5);
+    record.rawNs = block->rawNs;
+    record.realtimeNs = block->realtimeNs;
+    writeRecord(out->times, &record, sizeof(record), "Failed to write the time file");
+    out->batches++;
+}
+
+// Function: Add an index entry pointing at the end of the file, where the block starting with sample `firstSample` at `timestampNs` is written
+void writeIndex(OutputFile *out, long long timestampNs, unsigned long long firstSample)
+{
+    IndexEntry entry = {.timestampNs = timestampNs, .firstSample = firstSample, .offset = out->length};
+    writeRecord(out->index, &entry, sizeof(entry), "Failed to write the index");
+    // Keep the entries on a fixed grid, without catching up after a gap
+    out->indexNextNs = out->indexNextNs == 0 ? timestampNs + indexIntervalNs : out->indexNextNs + indexIntervalNs;
+    if (out->indexNextNs <= timestampNs)
+        out->indexNextNs = timestampNs + indexIntervalNs;
+}
+
+// Function: Flush and close the output file of a sensor, with the samples still waiting to be compressed
+void releaseOutput(pSensor arg)
+{
+    if (outputFormat == FORMAT_ARROW)
+        writeArrowFooter(arg);
+    else
+        writeFrame(arg);
+    closeFile(&arg->out);
+    closePyramid(&arg->pyramid);
+}
+
+// Function: Return 1 if `block` must start a new output file, because the current one reached the size of `-R` or the duration of `-T`
+int rotationDue(const OutputFile *out, const RingBlock *block)
+{
+    return (rotateBytes > 0 && out->length >= rotateBytes) || (rotateNs > 0 && out->startNs != 0 && block->timestampNs - out->startNs >= rotateNs);
+}
+
+// Function: Record a completed output file, the disk budget deletes the completed files in this order
+void retireSegment(const OutputFile *out)
+{
+    if (segmentCount == segmentSize)
+    {
+        // Reuse the entries of the deleted files before growing
+        if (segmentFirst > 0)
+        {
+            memmove(segments, segments + segmentFirst, (segmentCount - segmentFirst) * sizeof(Segment));
+            segmentCount -= segmentFirst;
+            segmentFirst = 0;
+        }
+        else
+        {
+            segmentSize = segmentSize > 0 ? 2 * segmentSize : 64;
+            segments = realloc(segments, segmentSize * sizeof(Segment));
+            if (segments == NULL)
+            {
+                perror("Failed to allocate the list of output files");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    Segment *segment = &segments[segmentCount++];
+    snprintf(segment->path, sizeof(segment->path), "%s", out->path);
+    segment->length = out->length + sidecarLength(out->path);
+}
+
+// Function: Return the size of the time file, the index and the pyramid of an output file, the ones that exist
+unsigned long long sidecarLength(const char *path)
+{
+    unsigned long long length = 0;
+    for (int i = 0; i < (int)(sizeof(sidecarSuffixes) / sizeof(sidecarSuffixes[0])); i++)
+    {
+        char sidecar[sizeof(segments->path) + 5];
+        struct stat info;
+        snprintf(sidecar, sizeof(sidecar), "%s%s", path, sidecarSuffixes[i]);
+        if (stat(sidecar, &info) == 0)
+            length += info.st_size;
+    }
+    return length;
+}
+
+// Function: Delete the oldest completed files while the files of the acquisition, including the ones being written, exceed the disk budget
+// The time files, indexes and pyramids count as well, a pyramid takes its preallocated size from the start
+void enforceBudget(pSensor sensors)
+{
+    unsigned long long total = sessionFile.fd != -1 ? sessionFile.length + sidecarLength(sessionFile.path) : 0;
+    for (int i = 0; i < sensorNum; i++)
+    {
+        if (sensors[i].out.fd != -1)
+            total += sensors[i].out.length + sidecarLength(sensors[i].out.path);
+    }
+    for (int i = segmentFirst; i < segmentCount; i++)
+        total += segments[i].length;
+    while (total > diskBudget && segmentFirst < segmentCount)
+    {
+        Segment *oldest = &segments[segmentFirst++];
+        if (unlink(oldest->path) != 0)
+            perror(oldest->path);
+        else
+            printf("Deleted %s to stay within the disk budget\n", oldest->path);
+        // Along with its time file, its index and its pyramid, if any
+        for (int i = 0; i < (int)(sizeof(sidecarSuffixes) / sizeof(sidecarSuffixes[0])); i++)
+        {
+            char path[sizeof(oldest->path) + 5];
+            snprintf(path, sizeof(path), "%s%s", oldest->path, sidecarSuffixes[i]);
+            unlink(path);
+        }
+        total -= oldest->length;
+    }
+}
+
+// Function: Write the samples waiting in the Arrow record batch as one record batch message, followed by its columns
+void writeArrowBatch(pSensor arg)
+{
+    ArrowBatch *batch = &arg->arrow;
+    if (batch->rows == 0)
+        return;
+    int64_t bodyLength;
+    unsigned char *metadata = arrowBatchMessage(&batch->builder, batch->rows, arg->channels, &bodyLength);
+    uint32_t prefix[2] = {ARROW_CONTINUATION, batch->builder.used};
+    // Remember where the batch starts for the footer
+    if (batch->blockCount == batch->blockSize)
+    {
+        batch->blockSize = batch->blockSize > 0 ? 2 * batch->blockSize : 64;
+        batch->blocks = realloc(batch->blocks, batch->blockSize * sizeof(ArrowBlock));
+        if (batch->blocks == NULL)
+        {
+            perror("Failed to allocate the Arrow record batches");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ArrowBlock block = {.offset = arg->out.length, .metaDataLength = sizeof(prefix) + batch->builder.used, .bodyLength = bodyLength};
+    batch->blocks[batch->blockCount++] = block;
+    outputWrite(&arg->out, prefix, sizeof(prefix));
+    outputWrite(&arg->out, metadata, batch->builder.used);
+    // The body is every column padded to 8 bytes
+    static const char padding[8];
+    for (int c = 0; c < arg->channels; c++)
+    {
+        outputWrite(&arg->out, batch->columns + c * ARROW_BATCH, batch->rows * sizeof(short));
+        outputWrite(&arg->out, padding, arrowPadded(batch->rows * sizeof(short)) - batch->rows * sizeof(short));
+    }
+    outputWrite(&arg->out, batch->timestamps, batch->rows * sizeof(int64_t));
+    batch->rows = 0;
+}
+
+// Function: Write the last Arrow record batch, then the end-of-stream marker and the footer
+void writeArrowFooter(pSensor arg)
+{
+    ArrowBatch *batch = &arg->arrow;
+    writeArrowBatch(arg);
+    uint32_t endOfStream[2] = {ARROW_CONTINUATION, 0};
+    outputWrite(&arg->out, endOfStream, sizeof(endOfStream));
+    unsigned char *footer = arrowFooter(&batch->builder, &batch->header, 1e9 / arg->estimatedPeriodNs, batch->blocks, batch->blockCount);
+    int32_t footerLength = batch->builder.used;
+    outputWrite(&arg->out, footer, footerLength);
+    outputWrite(&arg->out, &footerLength, sizeof(footerLength));
+    outputWrite(&arg->out, ARROW_MAGIC, strlen(ARROW_MAGIC));
+    free(batch->columns);
+    free(batch->timestamps);
+    free(batch->blocks);
+    free(batch->builder.data);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Function: Open the pyramid of the output file of a sensor, FILE.pyr, with a region per level sized for `samples`, see `-P`
+void openPyramid(pSensor arg, long long samples)
+{
+    Pyramid *pyramid = &arg->pyramid;
+    pyramid->records = NULL;
+    if (!pyramidOutput)
+        return;
+    char path[sizeof(arg->out.path) + 4];
+    snprintf(path, sizeof(path), "%s.pyr", arg->out.path);
+    pyramid->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (pyramid->fd == -1)
+    {
+        perror("Failed to open the pyramid");
+        exit(EXIT_FAILURE);
+    }
+    // Leave room for a sensor running a little faster than its nominal rate
+    PyramidHeader *header = &pyramid->header;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+    header->version = RECORDING_VERSION;
+    header->headerSize = sizeof(PyramidHeader);
+    header->odrMilliHz = (uint32_t)(arg->cfg.odr * 1000 + 0.5);
+    header->channels = arg->channels;
+    header->baseShift = PYRAMID_SHIFT;
+    header->firstSample = arg->nextSample;
+    struct timespec monotonic;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    header->startMonotonicNs = monotonic.tv_sec * 1000000000LL + monotonic.tv_nsec;
+    unsigned long long planned = samples + samples / 16 + 1, offset = sizeof(PyramidHeader);
+    size_t recordSize = 3 * arg->channels * sizeof(short);
+    for (int level = 0; level < PYRAMID_LEVELS; level++)
+    {
+        int shift = PYRAMID_SHIFT + level;
+        pyramid->capacity[level] = (planned + (1ULL << shift) - 1) >> shift;
+        pyramid->count[level] = pyramid->valid[level] = pyramid->buffered[level] = 0;
+        header->levels[level].offset = offset;
+        offset += pyramid->capacity[level] * recordSize;
+        header->levelCount = level + 1;
+        if (pyramid->capacity[level] == 1)
+            break;
+    }
+    pyramid->records = malloc(header->levelCount * PYRAMID_BUFFER * recordSize);
+    if (pyramid->records == NULL)
+    {
+        perror("Failed to allocate the pyramid");
+        exit(EXIT_FAILURE);
+    }
+    flushPyramid(pyramid);
+}
+
+// Function: Aggregate `count` converted samples of `channels` values into the first level of a pyramid
+void addPyramid(Pyramid *pyramid, const short *samples, int count, int channels)
+{
+    if (pyramid->records == NULL)
+        return;
+    for (int i = 0; i < count; i++, samples += channels)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            if (pyramid->valid[0] == 0 || samples[c] < pyramid->min[0][c])
+                pyramid->min[0][c] = samples[c];
+            if (pyramid->valid[0] == 0 || samples[c] > pyramid->max[0][c])
+                pyramid->max[0][c] = samples[c];
+            pyramid->sum[0][c] = (pyramid->valid[0] == 0 ? 0 : pyramid->sum[0][c]) + samples[c];
+        }
+        pyramid->valid[0]++;
+        if (++pyramid->count[0] == 1 << PYRAMID_SHIFT)
+            emitPyramid(pyramid, 0);
+    }
+}
+
+// Function: Move a pyramid over `count` lost samples, so that every record still starts at its place in the file
+// The records they cover are made of the samples around the gap, or are empty if the gap covers them whole
+void skipPyramid(Pyramid *pyramid, unsigned long long count)
+{
+    if (pyramid->records == NULL)
+        return;
+    while (count > 0)
+    {
+        unsigned long long room = (1ULL << PYRAMID_SHIFT) - pyramid->count[0];
+        unsigned long long step = count < room ? count : room;
+        pyramid->count[0] += step;
+        count -= step;
+        if (pyramid->count[0] == 1 << PYRAMID_SHIFT)
+            emitPyramid(pyramid, 0);
+    }
+}
+
+// Function: Store the pending record of a level, also when it is partial, and aggregate it into the next level
+void emitPyramid(Pyramid *pyramid, int level)
+{
+    PyramidHeader *header = &pyramid->header;
+    int channels = header->channels;
+    long long count = pyramid->count[level], valid = pyramid->valid[level];
+    // A sensor far faster than its nominal rate fills a level before the file ends, its last records are lost
+    if (header->levels[level].count + pyramid->buffered[level] < pyramid->capacity[level])
+    {
+        short *record = pyramid->records + (level * PYRAMID_BUFFER + pyramid->buffered[level]++) * 3 * channels;
+        for (int c = 0; c < channels; c++)
+        {
+            // Round the mean half away from zero. A record lost whole is empty, its minimum is above its maximum.
+            long long sum = pyramid->sum[level][c];
+            record[3 * c] = valid > 0 ? pyramid->min[level][c] : SHRT_MAX;
+            record[3 * c + 1] = valid > 0 ? pyramid->max[level][c] : SHRT_MIN;
+            record[3 * c + 2] = valid == 0 ? 0 : sum >= 0 ? (sum + valid / 2) / valid : -((-sum + valid / 2) / valid);
+        }
+    }
+    if (level == 0)
+        header->sampleCount += count;
+    if (level + 1 < header->levelCount)
+    {
+        int next = level + 1;
+        for (int c = 0; c < channels && valid > 0; c++)
+        {
+            if (pyramid->valid[next] == 0 || pyramid->min[level][c] < pyramid->min[next][c])
+                pyramid->min[next][c] = pyramid->min[level][c];
+            if (pyramid->valid[next] == 0 || pyramid->max[level][c] > pyramid->max[next][c])
+                pyramid->max[next][c] = pyramid->max[level][c];
+            pyramid->sum[next][c] = (pyramid->valid[next] == 0 ? 0 : pyramid->sum[next][c]) + pyramid->sum[level][c];
+        }
+        pyramid->count[next] += count;
+        pyramid->valid[next] += valid;
+        if (pyramid->count[next] == 1LL << (PYRAMID_SHIFT + next))
+            emitPyramid(pyramid, next);
+    }
+    pyramid->count[level] = pyramid->valid[level] = 0;
+    // The first level fills first, the others are written along with it
+    if (pyramid->buffered[level] == PYRAMID_BUFFER)
+        flushPyramid(pyramid);
+}
+
+// Function: Write the collected records of every level of a pyramid, then its header with their new number
+void flushPyramid(Pyramid *pyramid)
+{
+    PyramidHeader *header = &pyramid->header;
+    size_t recordSize = 3 * header->channels * sizeof(short);
+    for (int level = 0; level < header->levelCount; level++)
+    {
+        if (pyramid->buffered[level] == 0)
+            continue;
+        size_t length = pyramid->buffered[level] * recordSize;
+        if (pwrite(pyramid->fd, pyramid->records + level * PYRAMID_BUFFER * 3 * header->channels, length,
+                   header->levels[level].offset + header->levels[level].count * recordSize) != (ssize_t)length)
+            perror("Failed to write the pyramid");
+        header->levels[level].count += pyramid->buffered[level];
+        pyramid->buffered[level] = 0;
+    }
+    if (pwrite(pyramid->fd, header, sizeof(*header), 0) != sizeof(*header))
+        perror("Failed to write the pyramid");
+}
+
+// Function: Store the partial records of every level, move the levels next to each other and close a pyramid
+void closePyramid(Pyramid *pyramid)
+{
+    if (pyramid->records == NULL)
+        return;
+    PyramidHeader *header = &pyramid->header;
+    for (int level = 0; level < header->levelCount; level++)
+    {
+        if (pyramid->count[level] > 0)
+            emitPyramid(pyramid, level);
+    }
+    flushPyramid(pyramid);
+    // Close up the unused end of every region, each level moves towards the start of the file
+    size_t recordSize = 3 * header->channels * sizeof(short);
+    unsigned long long offset = sizeof(PyramidHeader);
+    char chunk[1 << 16];
+    for (int level = 0; level < header->levelCount; level++)
+    {
+        unsigned long long length = header->levels[level].count * recordSize;
+        for (unsigned long long done = 0; offset != header->levels[level].offset && done < length;)
+        {
+            size_t part = length - done < sizeof(chunk) ? length - done : sizeof(chunk);
+            if (pread(pyramid->fd, chunk, part, header->levels[level].offset + done) != (ssize_t)part ||
+                pwrite(pyramid->fd, chunk, part, offset + done) != (ssize_t)part)
+            {
+                perror("Failed to close up the pyramid");
+                break;
+            }
+            done += part;
+        }
+        header->levels[level].offset = offset;
+        offset += length;
+    }
+    if (pwrite(pyramid->fd, header, sizeof(*header), 0) != sizeof(*header) || ftruncate(pyramid->fd, offset) != 0)
+        perror("Failed to write the pyramid");
+    close(pyramid->fd);
+    free(pyramid->records);
+    pyramid->records = NULL;
+}
+
+// Function: Compress the samples waiting in `frame` into one block of the output file
+void writeFrame(pSensor arg)
+{
+    if (arg->frameCount == 0)
+        return;
+    // Encode straight behind the block header, then fill in the size
+    char *data = outputReserve(&arg->out, sizeof(BlockHeader) + codecBound(arg->frameCount, arg->channels));
+    BlockHeader header = {.firstSample = arg->frameFirst, .sampleCount = arg->frameCount};
+    header.payloadSize = codecEncode((unsigned char *)data + sizeof(header), arg->frame, arg->frameCount, arg->channels);
+    memcpy(data, &header, sizeof(header));
+    outputCommit(&arg->out, sizeof(header) + header.payloadSize);
+    arg->frameCount = 0;
+}
+
+// Function: Record the samples lost before a block, overwritten in the FIFO or dropped with a full ring, with a gap record
+// in a binary recording, see AIS2IH_format.h. The CSV and Arrow files keep only samples, their time files show the gap.
+void writeGap(pSensor arg, const RingBlock *block)
+{
+    if (block->firstSample <= arg->nextSample)
+        return;
+    unsigned long long lost = block->firstSample - arg->nextSample;
+    arg->gapSamples += lost;
+    arg->gaps++;
+    skipPyramid(&arg->pyramid, lost);
+    if (outputFormat != FORMAT_BIN && outputFormat != FORMAT_PACKED)
+        return;
+    BlockHeader gap = {.firstSample = arg->nextSample, .sampleCount = 0, .payloadSize = lost > UINT32_MAX ? UINT32_MAX : (uint32_t)lost};
+    if (sessionOutput)
+    {
+        SessionBlockHeader header = {.timestampNs = block->timestampNs, .sensor = arg->sensorIndex, .block = gap};
+        outputWrite(&sessionFile, &header, sizeof(header));
+        return;
+    }
+    // The compressed samples before the gap make their own block, and a mapped recording does not extend a block over it
+    writeFrame(arg);
+    arg->out.lastBlock = 0;
+    outputWrite(&arg->out, &gap, sizeof(gap));
+}
+
+// Function: Convert a block and write it to the output file
+void writeBlock(pSensor arg, const RingBlock *block)
+{
+    // Switch to the next file between two blocks, the sensor keeps running meanwhile
+    if (rotationDue(&arg->out, block))
+    {
+        releaseOutput(arg);
+        retireSegment(&arg->out);
+        arg->segment++;
+        openSegment(arg);
+    }
+    if (arg->out.startNs == 0)
+        arg->out.startNs = block->timestampNs;
+    // The gap record goes before the index entry, which points at the samples of the block
+    writeGap(arg, block);
+    if (arg->out.index != NULL && block->timestampNs >= arg->out.indexNextNs)
+    {
+        // The entry must point at the start of a block: the waiting compressed samples are written first, and a mapped
+        // binary recording does not extend its last block over the entry
+        writeFrame(arg);
+        arg->out.lastBlock = 0;
+        writeIndex(&arg->out, block->timestampNs - (block->count - 1) * arg->periodNs, block->firstSample);
+    }
+    writeTimes(&arg->out, arg, block);
+    arg->nextSample = block->firstSample + block->count;
+    short samples[FIFO_DEPTH * 3];
+    int channels = convertSamples(arg, block, samples);
+    addPyramid(&arg->pyramid, samples, block->count, channels);
+    if (outputFormat == FORMAT_PACKED)
+    {
+        // Collect the samples into frames of CODEC_FRAME, a gap or a full frame starts a new one
+        if (arg->frameCount > 0 && (arg->frameFirst + arg->frameCount != block->firstSample || arg->frameCount + block->count > CODEC_FRAME))
+            writeFrame(arg);
+        if (arg->frameCount == 0)
+            arg->frameFirst = block->firstSample;
+        memcpy(arg->frame + arg->frameCount * channels, samples, sizeof(short) * channels * block->count);
+        arg->frameCount += block->count;
+        if (arg->frameCount == CODEC_FRAME)
+            writeFrame(arg);
+        return;
+    }
+    if (outputFormat == FORMAT_ARROW)
+    {
+        // Fill the columns of the record batch, each sample is dated back from the read time of the block by the estimated period.
+        // The read times jitter, so a block read early could date its first samples before the last ones of the previous block,
+        // the column is kept monotonic for the readers that search it.
+        ArrowBatch *batch = &arg->arrow;
+        for (int i = 0; i < block->count; i++)
+        {
+            for (int c = 0; c < channels; c++)
+                batch->columns[c * ARROW_BATCH + batch->rows] = samples[i * channels + c];
+            int64_t timestamp = block->realtimeNs - (long long)((block->count - 1 - i) * arg->estimatedPeriodNs + 0.5);
+            if (timestamp < batch->lastTimestamp)
+                timestamp = batch->lastTimestamp;
+            batch->timestamps[batch->rows] = batch->lastTimestamp = timestamp;
+            if (++batch->rows == ARROW_BATCH)
+                writeArrowBatch(arg);
+        }
+        return;
+    }
+    if (outputFormat == FORMAT_BIN)
+    {
+        OutputFile *out = &arg->out;
+        if (out->mapped && out->lastBlock != 0)
+        {
+            // In a mapped file, samples that follow the last block without a gap extend it, so the preallocated size is exact
+            BlockHeader *last = (BlockHeader *)(out->data + out->lastBlock);
+            if (last->firstSample + last->sampleCount == block->firstSample)
+            {
+                last->sampleCount += block->count;
+                outputWrite(out, samples, sizeof(short) * channels * block->count);
+                return;
+            }
+        }
+        // One block per read, the samples are stored as converted
+        BlockHeader header = {.firstSample = block->firstSample, .sampleCount = block->count};
+        outputWrite(out, &header, sizeof(header));
+        out->lastBlock = out->used - sizeof(header);
+        outputWrite(out, samples, sizeof(short) * channels * block->count);
+        return;
+    }
+    // Format the whole block straight into the buffer or the mapping, in the "x,y,z" layout of fprintf
+    char *text = outputReserve(&arg->out, (size_t)block->count * channels * CSV_VALUE_MAX);
+    outputCommit(&arg->out, formatCsv(text, samples, block->count, channels));
+}
+
+// Function: Convert a block and write it to the session recording, behind the sensor and the time it was read
+void writeSessionBlock(pSensor arg, const RingBlock *block)
+{
+    if (sessionFile.startNs == 0)
+        sessionFile.startNs = block->timestampNs;
+    writeGap(arg, block);
+    if (sessionFile.index != NULL && block->timestampNs >= sessionFile.indexNextNs)
+        writeIndex(&sessionFile, block->timestampNs, sessionFile.batches);
+    writeTimes(&sessionFile, arg, block);
+    arg->nextSample = block->firstSample + block->count;
+    short samples[FIFO_DEPTH * 3];
+    int channels = convertSamples(arg, block, samples);
+    SessionBlockHeader header = {.timestampNs = block->timestampNs, .sensor = arg->sensorIndex};
+    header.block.firstSample = block->firstSample;
+    header.block.sampleCount = block->count;
+    // Encode straight behind the block header, the packed samples of one read make one independent block
+    size_t length = sizeof(short) * channels * block->count;
+    char *data = outputReserve(&sessionFile, sizeof(header) + (outputFormat == FORMAT_PACKED ? (size_t)codecBound(block->count, channels) : length));
+    if (outputFormat == FORMAT_PACKED)
+        length = header.block.payloadSize = codecEncode((unsigned char *)data + sizeof(header), samples, block->count, channels);
+    else
+        memcpy(data + sizeof(header), samples, length);
+    memcpy(data, &header, sizeof(header));
+    outputCommit(&sessionFile, sizeof(header) + length);
+}
+
+// Function: Write every block waiting in the ring of a sensor, return their number
+int drainRing(pSensor arg)
+{
+    SampleRing *ring = arg->ring;
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (unsigned i = tail; i != head; i++)
+        writeBlock(arg, &ring->blocks[i % RING_BLOCKS]);
+    // Give the blocks back to the bus thread
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+    return head - tail;
+}
+
+// Function: Write the blocks waiting in the rings of all sensors to the session recording in time order, return their number
+// The oldest block is only written once every sensor still running has a block waiting, since each ring is in time order
+// and no earlier block can then follow. A sensor that stalls holds the others back for at most `windowNs`.
+int mergeRings(pSensor sensors, long long windowNs)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long nowNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+    int written = 0;
+    for (;;)
+    {
+        pSensor next = NULL;
+        const RingBlock *oldest = NULL;
+        int waiting = 0;
+        for (int i = 0; i < sensorNum; i++)
+        {
+            SampleRing *ring = sensors[i].ring;
+            // Read `closed` first, a ring that is still empty after it was closed stays empty
+            int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+            unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+            {
+                waiting |= !closed;
+                continue;
+            }
+            const RingBlock *block = &ring->blocks[tail % RING_BLOCKS];
+            if (oldest == NULL || block->timestampNs < oldest->timestampNs)
+            {
+                next = sensors + i;
+                oldest = block;
+            }
+        }
+        if (oldest == NULL || (waiting && nowNs - oldest->timestampNs < windowNs))
+            return written;
+        if (rotationDue(&sessionFile, oldest))
+        {
+            closeFile(&sessionFile);
+            retireSegment(&sessionFile);
+            sessionSegment++;
+            openSession(sensors);
+        }
+        writeSessionBlock(next, oldest);
+        // Give the block back to the bus thread
+        unsigned tail = atomic_load_explicit(&next->ring->tail, memory_order_relaxed);
+        atomic_store_explicit(&next->ring->tail, tail + 1, memory_order_release);
+        written++;
+    }
+}
+
+// Thread writing the samples of every sensor to its output file, or all of them to the session recording
+// The files are fully buffered with WRITER_BUFFER bytes, so a stalled write only holds up this thread while the rings fill
+void *writerThread(void *arg)
+{
+    pSensor sensors = (pSensor)arg;
+    if (lockMemory)
+        prefaultStack();
+    // A session recording waits for the blocks of every sensor, allow for two drains of the slowest one before giving up on it
+    long long windowNs = 0;
+    for (int i = 0; i < sensorNum; i++)
+    {
+        long long drainNs = 2 * (acqMode == MODE_POLL ? FIFO_DEPTH : sensors[i].cfg.watermark) * sensors[i].periodNs;
+        windowNs = drainNs > windowNs ? drainNs : windowNs;
+    }
+    for (;;)
+    {
+        // Read the flag before draining, the blocks pushed before the bus threads finished are then all drained in this pass
+        int stopping = atomic_load(&acquisitionDone);
+        int blocks = sessionOutput ? mergeRings(sensors, windowNs) : 0;
+        for (int i = 0; i < sensorNum; i++)
+        {
+            pSensor sensor = sensors + i;
+            SampleRing *ring = sensor->ring;
+            if (sensor->finished)
+                continue;
+            // Once the bus thread published its last block, write what is left and close the file
+            int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+            if (!sessionOutput)
+                blocks += drainRing(sensor);
+            if (!closed || atomic_load_explicit(&ring->tail, memory_order_relaxed) != atomic_load_explicit(&ring->head, memory_order_acquire))
+                continue;
+            sensor->finished = 1;
+            if (sensor->out.fd != -1)
+                releaseOutput(sensor);
+            if (!sensor->ready)
+                continue;
+            printf("Sensor %d: up to %u of %d ring blocks were waiting for the writer", sensor->sensorIndex, ring->highWater, RING_BLOCKS);
+            if (sensor->fitDeviation > FIT_MAX_DEVIATION)
+                printf(", the output data rate could not be measured");
+            else if (sensor->periodErrorPpm == 0)
+                printf(", too few steady blocks to measure the output data rate");
+            else
+                printf(", measured %.4f Hz (%+.1f ± %.1f ppm)", 1e9 / sensor->estimatedPeriodNs,
+                       (sensor->periodNs / sensor->estimatedPeriodNs - 1) * 1e6, sensor->periodErrorPpm);
+            if (ring->overwritten > 0)
+                printf(", about %llu samples were overwritten in %u FIFO overruns", ring->overwritten, ring->overruns);
+            if (ring->dropped > 0)
+                printf(", %llu samples were dropped because the ring was full", ring->dropped);
+            if (sensor->gaps > 0)
+                printf(", %u gaps were recorded", sensor->gaps);
+            printf("\n");
+            if (sensor->fitDeviation > FIT_MAX_DEVIATION)
+                printf("Warning! The read times of sensor %d stray by %.1f sample periods from a steady rate, e.g. after a miscounted loss, "
+                       "its nominal period is recorded instead of a measured one.\n", sensor->sensorIndex, sensor->fitDeviation);
+        }
+        if (diskBudget > 0)
+            enforceBudget(sensors);
+        if (stopping)
+            break;
+        if (blocks == 0)
+            usleep(WRITER_IDLE_US);
+    }
+    if (sessionFile.fd != -1)
+        closeFile(&sessionFile);
+    pthread_exit(NULL);
+}
+
+// Function: Read the FIFO level, book the samples lost since the last drain and return the level
+int readLevel(pSensor arg, long long *beforeNs)
+{
+    // The level is sampled at some point of the read, which is bracketed on CLOCK_MONOTONIC_RAW from `beforeNs` to `newestRawNs`.
+    // A read delayed e.g. by preemption does not tell when the level was sampled, so it is read again, keeping FIFO_OVR.
+    struct timespec raw;
+    int status = 0, level;
+    long long nowNs;
+    for (int attempt = 0; attempt < LEVEL_ATTEMPTS; attempt++)
+    {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+        *beforeNs = raw.tv_sec * 1000000000LL + raw.tv_nsec;
+        int value = readRegOneByte(arg, FIFO_SAMPLES);
+        status |= value & 0x40;
+        level = value & 0x3F;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+        nowNs = raw.tv_sec * 1000000000LL + raw.tv_nsec;
+        if (nowNs - *beforeNs <= readCostNs(arg->bus, 1) + arg->periodNs / 2)
+            break;
+    }
+    // The samples lost since the last drain are the conversions of the elapsed time that are not in the FIFO any more.
+    // FIFO_OVR reports an overrun since the last read of the FIFO, but one that happens during a burst read is cleared by
+    // that same read. So a loss is also booked when fewer samples are waiting than the conversions certainly made since
+    // the last drain, counted over the shortest interval the two levels can be apart, which no scheduling delay can inflate,
+    // and when the FIFO may have filled up before the last drain read its first sample, which overwrote one per conversion.
+    // Their indexes are skipped, so the writer thread records the gap, and they count towards the samples to collect like the dropped ones.
+    long long certain = (*beforeNs - arg->newestRawNs) / arg->periodNs + arg->leftInFifo - level;
+    long long lost = (nowNs - arg->newestRawNs + arg->periodNs / 2) / arg->periodNs + arg->leftInFifo - level;
+    if ((status & 0x40) || certain > 0 || (arg->overrunHidden && lost > 0))
+    {
+        lost = lost > certain ? lost : certain;
+        if (lost < 1)
+            lost = 1;
+        publishSamples(arg);
+        arg->ring->overwritten += lost;
+        arg->ring->overruns++;
+        arg->written += lost;
+        arg->remaining -= lost < arg->remaining ? lost : arg->remaining;
+    }
+    arg->newestRawNs = nowNs;
+    arg->overrunHidden = 0;
+    return level;
+}
+
+// Function: Drain the FIFO in one read and queue the samples for the writer thread, return the number of samples drained
+int drainFifo(pSensor arg)
+{
+    // Check how many samples are waiting in the FIFO, and whether it overran since the last drain
+    long long beforeNs;
+    int level = readLevel(arg, &beforeNs);
+    int count = level < arg->remaining ? level : arg->remaining;
+    arg->leftInFifo = level - count;
+    if (count > 0)
+    {
+        // Count the conversions since the level was read up to the first sample of the burst, with one for the phase
+        struct timespec raw;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+        double firstReadNs = raw.tv_sec * 1000000000LL + raw.tv_nsec + arg->bus->fixedCostNs + BUFFER_SIZE * arg->bus->byteCostNs;
+        arg->overrunHidden = level + (firstReadNs - beforeNs) / arg->periodNs + 1 >= FIFO_DEPTH;
+        // Drain all pending samples in one read, the address rolls back from OUT_Z_H to OUT_X_L in FIFO mode
+        readRegBytes(arg, OUT_X_L, count * BUFFER_SIZE);
+        pushSamples(arg, OUT_X_L, BUFFER_SIZE, count, level - count, (beforeNs + arg->newestRawNs) / 2);
+        publishSamples(arg);
+        arg->remaining -= count;
+        // No later drain will find an overrun that the last one may have hidden, so the level is checked once more
+        if (arg->overrunHidden && arg->remaining == 0)
+            readLevel(arg, &beforeNs);
+    }
+    return count;
+}
+
+// Function: Read one sample if the STATUS register reports new data, return the number of samples read
+int pollSample(pSensor arg)
+{
+    // Check the status register to determine if new data is available
+    if ((readRegOneByte(arg, STATUS) & 1) == 0)
+        return 0;
+    // Read data into the buffer
+    readRegBytes(arg, arg->readStart, arg->readLength);
+    // The single samples are collected into blocks of a FIFO's worth
+    pushSamples(arg, arg->readStart, arg->readLength, 1, 0, 0);
+    if (arg->pending == FIFO_DEPTH)
+        publishSamples(arg);
+    // Update the remaining sample count
+    arg->remaining--;
+    return 1;
+}
+
+// Function: Move a timespec forward (or backward) by `ns` nanoseconds
+void addNanoseconds(struct timespec *ts, long long ns)
+{
+    long long total = ts->tv_nsec + ns;
+    ts->tv_sec += total / 1000000000LL;
+    ts->tv_nsec = total % 1000000000LL;
+    if (ts->tv_nsec < 0)
+    {
+        ts->tv_nsec += 1000000000LL;
+        ts->tv_sec -= 1;
+    }
+}
+
+// Function: Return `a` - `b` in nanoseconds
+long long diffNanoseconds(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+// Function: Open an output file for the writer thread, with `-M` preallocated to `mapSize` bytes and mapped in memory
+void openFile(OutputFile *out, const char *path, size_t mapSize)
+{
+    out->mapped = mapOutput;
+    out->used = out->flushed = out->lastBlock = 0;
+    out->length = 0;
+    out->startNs = 0;
+    snprintf(out->path, sizeof(out->path), "%s", path);
+    if (mapOutput)
+    {
+        out->size = mapSize;
+        out->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (out->fd == -1 || fallocate(out->fd, 0, 0, out->size) != 0)
+        {
+            perror("Failed to preallocate output file");
+            exit(EXIT_FAILURE);
+        }
+        out->data = mmap(NULL, out->size, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+        if (out->data == MAP_FAILED)
+        {
+            perror("Failed to map output file");
+            exit(EXIT_FAILURE);
+        }
+        madvise(out->data, out->size, MADV_SEQUENTIAL);
+    }
+    else
+    {
+        // Open the file for writing, the CSV files are appended to as before
+        out->fd = open(path, O_WRONLY | O_CREAT | (outputFormat == FORMAT_CSV ? O_APPEND : O_TRUNC), 0644);
+        out->size = WRITER_BUFFER;
+        out->data = malloc(out->size);
+        if (out->fd == -1 || out->data == NULL)
+        {
+            perror("Failed to open output file for writing");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Function: Describe a sensor and its configuration, so that its binary recording can be interpreted on its own
+void fillHeader(pSensor arg, RecordingHeader *header, long long realtimeNs, long long monotonicNs)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    header->version = RECORDING_VERSION;
+    header->headerSize = sizeof(RecordingHeader);
+    header->sensorIndex = arg->sensorIndex;
+    header->address = arg->i2cAddress;
+    snprintf(header->bus, sizeof(header->bus), "%s", arg->cfg.bus);
+    snprintf(header->powerMode, sizeof(header->powerMode), "%s", powerModes[arg->cfg.powerMode].name);
+    header->odrMilliHz = (uint32_t)(arg->cfg.odr * 1000 + 0.5);
+    header->fullScale = arg->cfg.fullScale;
+    header->resolution = arg->cfg.highOnly ? 8 : powerModes[arg->cfg.powerMode].resolution;
+    header->axes = arg->cfg.axes;
+    header->channels = arg->channels;
+    header->watermark = arg->cfg.watermark;
+    header->codec = outputFormat == FORMAT_PACKED ? CODEC_DELTA_PACK : CODEC_RAW;
+    header->startRealtimeNs = realtimeNs;
+    header->startMonotonicNs = monotonicNs;
+    header->firstSample = arg->nextSample;
+}
+
+// Function: Reset the counters of a sensor before its first sample, and open its first output file unless it goes to the session recording
+void openOutput(pSensor arg)
+{
+    arg->written = 0;
+    arg->frameCount = 0;
+    arg->nextSample = 0;
+    arg->gapSamples = 0;
+    arg->gaps = 0;
+    arg->segment = 0;
+    arg->anchorRawNs = 0;
+    arg->fitCount = arg->fitMeanSample = arg->fitMeanNs = arg->fitSampleSquares = arg->fitProducts = arg->fitTimeSquares = 0;
+    arg->fitBlocks = arg->fitPooledSamples = arg->fitPooledProducts = arg->fitPooledTimes = 0;
+    arg->fitRuns = 0;
+    arg->fitWaiting = 0;
+    arg->estimatedPeriodNs = arg->periodNs;
+    arg->periodErrorPpm = 0;
+    arg->fitDeviation = 0;
+    if (!sessionOutput)
+        openSegment(arg);
+}
+
+// Function: Return the largest number of samples the next output file of a sensor takes, to size its preallocation
+long long segmentSamples(pSensor arg)
+{
+    long long samples = arg->sampleTarget - (long long)arg->nextSample;
+    if (rotateNs > 0 && rotateNs / arg->periodNs + FIFO_DEPTH < samples)
+        samples = rotateNs / arg->periodNs + FIFO_DEPTH;
+    // A file only bounded by `-R` is preallocated to that size instead
+    return samples < (1LL << 32) ? samples : 1LL << 32;
+}
+
+// Function: Open the next output file of a sensor and write its header, called by the writer thread when it starts a new file
+void openSegment(pSensor arg)
+{
+    // Use the start time of the acquisition as part of the filename, and the number of the file when it is split
+    char outputFileName[64], segment[16] = "";
+    if (rotateBytes > 0 || rotateNs > 0)
+        snprintf(segment, sizeof(segment), "_%04d", arg->segment);
+    snprintf(outputFileName, sizeof(outputFileName), "%s/%s_sensor%d%s.%s", data_path, sessionTime, arg->sensorIndex, segment,
+             outputFormat == FORMAT_CSV ? "csv" : outputFormat == FORMAT_ARROW ? "arrow" : "bin");
+    // With `-M`, preallocate the whole file: the exact size of a binary recording, or the longest possible CSV lines or compressed blocks
+    // Every index entry starts one more block
+    size_t samples = segmentSamples(arg), mapSize;
+    size_t entries = indexIntervalNs > 0 ? samples * arg->periodNs / indexIntervalNs + 1 : 0;
+    if (outputFormat == FORMAT_BIN)
+        mapSize = sizeof(RecordingHeader) + (entries + 1) * sizeof(BlockHeader) + samples * arg->channels * sizeof(short);
+    else if (outputFormat == FORMAT_PACKED)
+        mapSize = sizeof(RecordingHeader) + (samples / CODEC_FRAME + entries + 1) * (sizeof(BlockHeader) + codecBound(CODEC_FRAME, arg->channels));
+    else if (outputFormat == FORMAT_ARROW)
+        mapSize = 8 * 1024 + (samples / ARROW_BATCH + 1) * 1024 + samples * (arg->channels * sizeof(short) + sizeof(int64_t));
+    else
+        mapSize = samples * arg->channels * CSV_VALUE_MAX;
+    if (rotateBytes > 0 && rotateBytes + ROTATE_SLACK < mapSize)
+        mapSize = rotateBytes + ROTATE_SLACK;
+    openFile(&arg->out, outputFileName, mapSize);
+    openIndex(&arg->out, arg);
+    openTimes(&arg->out, arg, 1);
+    openPyramid(arg, samples);
+    if (outputFormat == FORMAT_CSV)
+        return;
+    RecordingHeader header;
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    fillHeader(arg, &header, realtime.tv_sec * 1000000000LL + realtime.tv_nsec, monotonic.tv_sec * 1000000000LL + monotonic.tv_nsec);
+    if (outputFormat != FORMAT_ARROW)
+    {
+        outputWrite(&arg->out, &header, sizeof(header));
+        return;
+    }
+    // An Arrow file starts with its magic and the schema, the columns of a record batch are collected before it is written
+    ArrowBatch *batch = &arg->arrow;
+    memset(batch, 0, sizeof(*batch));
+    batch->header = header;
+    batch->columns = malloc(ARROW_BATCH * arg->channels * sizeof(short));
+    batch->timestamps = malloc(ARROW_BATCH * sizeof(int64_t));
+    if (batch->columns == NULL || batch->timestamps == NULL)
+    {
+        perror("Failed to allocate the Arrow record batch");
+        exit(EXIT_FAILURE);
+    }
+    outputWrite(&arg->out, ARROW_MAGIC "\0\0", 8);
+    unsigned char *schema = arrowSchemaMessage(&batch->builder, &header);
+    uint32_t prefix[2] = {ARROW_CONTINUATION, batch->builder.used};
+    outputWrite(&arg->out, prefix, sizeof(prefix));
+    outputWrite(&arg->out, schema, batch->builder.used);
+}
+
+// Function: Open the next file of the session recording of all sensors and write its headers, see `-U`
+void openSession(pSensor sensors)
+{
+    char outputFileName[64], segment[16] = "";
+    if (rotateBytes > 0 || rotateNs > 0)
+        snprintf(segment, sizeof(segment), "_%04d", sessionSegment);
+    snprintf(outputFileName, sizeof(outputFileName), "%s/%s_session%s.bin", data_path, sessionTime, segment);
+    // With `-M`, preallocate every sample with one block header per expected read, the file grows if the reads are smaller
+    size_t mapSize = sizeof(SessionHeader) + sensorNum * sizeof(RecordingHeader);
+    for (int i = 0; i < sensorNum; i++)
+    {
+        int blockSamples = acqMode == MODE_POLL ? FIFO_DEPTH : sensors[i].cfg.watermark > 0 ? sensors[i].cfg.watermark : 1;
+        size_t blocks = segmentSamples(sensors + i) / blockSamples + 1;
+        mapSize += blocks * (sizeof(SessionBlockHeader) + (outputFormat == FORMAT_PACKED ? (size_t)codecBound(blockSamples, sensors[i].channels)
+                                                                                          : blockSamples * sensors[i].channels * sizeof(short)));
+    }
+    if (rotateBytes > 0 && rotateBytes + ROTATE_SLACK < mapSize)
+        mapSize = rotateBytes + ROTATE_SLACK;
+    openFile(&sessionFile, outputFileName, mapSize);
+    openIndex(&sessionFile, NULL);
+    openTimes(&sessionFile, sensors, sensorNum);
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    SessionHeader header = {.magic = SESSION_MAGIC, .version = RECORDING_VERSION, .headerSize = sizeof(SessionHeader), .sensorCount = sensorNum};
+    header.startRealtimeNs = realtime.tv_sec * 1000000000LL + realtime.tv_nsec;
+    header.startMonotonicNs = monotonic.tv_sec * 1000000000LL + monotonic.tv_nsec;
+    outputWrite(&sessionFile, &header, sizeof(header));
+    // Every sensor is listed, including the ones that fail to start, so that the blocks name a sensor by its index
+    for (int i = 0; i < sensorNum; i++)
+    {
+        RecordingHeader sensorHeader;
+        fillHeader(sensors + i, &sensorHeader, header.startRealtimeNs, header.startMonotonicNs);
+        outputWrite(&sessionFile, &sensorHeader, sizeof(sensorHeader));
+    }
+}
+
+// Function: Signal handler of SIGINT and SIGTERM, ask the bus threads to stop, they then complete their files
+void requestStop(int signal)
+{
+    (void)signal;
+    atomic_store(&stopRequested, 1);
+}
+
+// Function: Loop to read data from the sensors on one I2C bus and write it to files
+// The sensors of a bus are always serviced back-to-back by this one thread, so they never contend for the adapter
+void loop(pBus arg)
+{
+    // The sensors still collecting samples, and their interrupt sources for the irq mode
+    pSensor active[MAX_BUS_SENSORS];
+    EventSource *events[MAX_BUS_SENSORS];
+    int activeNum = 0;
+    for (int i = 0; i < arg->sensorCount; i++)
+    {
+        // A sensor that failed to start has no samples to wait for
+        if (!arg->sensors[i]->ready)
+        {
+            closeOutput(arg->sensors[i]);
+            continue;
+        }
+        openOutput(arg->sensors[i]);
+        arg->sensors[i]->remaining = arg->sensors[i]->sampleTarget;
+        active[activeNum] = arg->sensors[i];
+        events[activeNum++] = &arg->sensors[i]->event;
+    }
+    // Start the sensors of all buses together: once every thread configured its sensors, one of them sets the start time,
+    // and every thread sleeps until then and starts its own sensors back-to-back
+    if (pthread_barrier_wait(&startBarrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        addNanoseconds(&startTime, START_DELAY_US * 1000LL);
+    }
+    pthread_barrier_wait(&startBarrier);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &startTime, NULL) == EINTR)
+        ;
+    for (int i = 0; i < activeNum; i++)
+    {
+        if (startSensor(active[i]) == 0)
+            continue;
+        printf("Sensor %d failed to start. Skipping it.\n", active[i]->sensorIndex);
+        closeOutput(active[i]);
+        closeEventSource(&active[i]->event);
+        active[i] = active[activeNum - 1];
+        events[i] = events[activeNum - 1];
+        activeNum--;
+        i--;
+    }
+    // Every start is recorded before the first samples reach the writer thread, which writes them in the time files
+    pthread_barrier_wait(&startBarrier);
+    // What the thread suffers from here on goes to the jitter report
+    struct rusage before, after;
+    getrusage(RUSAGE_THREAD, &before);
+    // Every sensor is first drained once its FIFO should hold a watermark's worth of samples
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < activeNum; i++)
+    {
+        active[i]->deadline = now;
+        addNanoseconds(&active[i]->deadline, active[i]->cfg.watermark * active[i]->periodNs);
+    }
+    // Continue reading as long as any sensor has unread samples, or until SIGINT or SIGTERM
+    while (activeNum > 0 && !atomic_load_explicit(&stopRequested, memory_order_relaxed))
+    {
+        if (acqMode == MODE_IRQ)
+        {
+            // INT1 rises when the FIFO reaches its watermark. If the edge is missed, e.g. because the FIFO was not fully drained
+            // and the line never fell, the timeout of two watermark periods of the fastest sensor makes sure the loop still makes progress
+            long long timeoutNs = active[0]->cfg.watermark * active[0]->periodNs;
+            for (int i = 1; i < activeNum; i++)
+            {
+                if (active[i]->cfg.watermark * active[i]->periodNs < timeoutNs)
+                    timeoutNs = active[i]->cfg.watermark * active[i]->periodNs;
+            }
+            if (waitEvents(events, activeNum, (int)(2 * timeoutNs / 1000000) + 1) < 0)
+            {
+                printf("Bus %d failed to wait for its interrupts.\n", arg->busIndex);
+                break;
+            }
+            // Drain every sensor of the bus as one batch, the ones that did not interrupt yet are close to their watermark as well
+            for (int i = 0; i < activeNum; i++)
+                drainFifo(active[i]);
+        }
+        else if (acqMode == MODE_PACED)
+        {
+            // Sleep until the FIFO of the most urgent sensor is expected to hold a watermark's worth of samples
+            struct timespec wakeup = active[0]->deadline;
+            for (int i = 1; i < activeNum; i++)
+            {
+                if (diffNanoseconds(&active[i]->deadline, &wakeup) < 0)
+                    wakeup = active[i]->deadline;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR)
+                ;
+            // Drain back-to-back every sensor whose deadline is due, or close enough that waking up again for it would be wasted
+            recordWakeup(arg, &wakeup, &now);
+            for (int i = 0; i < activeNum; i++)
+            {
+                pSensor sensor = active[i];
+                long long watermarkNs = sensor->cfg.watermark * sensor->periodNs;
+                if (diffNanoseconds(&sensor->deadline, &now) > watermarkNs / 4)
+                    continue;
+                int count = drainFifo(sensor);
+                // The FIFO should have held exactly `watermark` samples. Move the next deadline by half of the observed error,
+                // so that the pacing follows the real output data rate without oscillating on scheduling noise
+                addNanoseconds(&sensor->deadline, watermarkNs + (sensor->cfg.watermark - count) * sensor->periodNs / 2);
+                // Resynchronize instead of catching up if the thread fell more than a watermark period behind, e.g. after it was
+                // descheduled for a long time. A smaller lag is absorbed by the next deadline, which is then already due.
+                if (diffNanoseconds(&now, &sensor->deadline) > watermarkNs)
+                    sensor->deadline = now;
+            }
+        }
+        else if (acqMode == MODE_BURST)
+        {
+            long long sleepNs = FIFO_DEPTH / 2 * active[0]->periodNs;
+            for (int i = 0; i < activeNum; i++)
+            {
+                drainFifo(active[i]);
+                if (FIFO_DEPTH / 2 * active[i]->periodNs < sleepNs)
+                    sleepNs = FIFO_DEPTH / 2 * active[i]->periodNs;
+            }
+            // Give the FIFOs time to refill to about half of their depth before checking them again
+            struct timespec wakeup;
+            clock_gettime(CLOCK_MONOTONIC, &wakeup);
+            addNanoseconds(&wakeup, sleepNs);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR)
+                ;
+            recordWakeup(arg, &wakeup, &now);
+        }
+        else
+        {
+            for (int i = 0; i < activeNum; i++)
+                pollSample(active[i]);
+        }
+        // Count the moves of the thread between CPUs, which cost it its caches, see `-A`
+        int cpu = sched_getcpu();
+        if (cpu != arg->lastCpu && arg->lastCpu != -1)
+            arg->migrations++;
+        arg->lastCpu = cpu;
+        // Retire the sensors that have collected all their samples
+        for (int i = 0; i < activeNum; i++)
+        {
+            if (active[i]->remaining > 0)
+                continue;
+            closeOutput(active[i]); // Let the writer thread close the output file
+            printf("\nSensor %d completed!\n", active[i]->sensorIndex);
+            active[i] = active[activeNum - 1];
+            events[i] = events[activeNum - 1];
+            activeNum--;
+            i--;
+        }
+    }
+    // Close the output files left open if the loop was stopped or aborted, the writer thread still writes every sample read
+    for (int i = 0; i < activeNum; i++)
+    {
+        closeOutput(active[i]);
+        printf("\nSensor %d stopped after %llu samples.\n", active[i]->sensorIndex, active[i]->written);
+    }
+    getrusage(RUSAGE_THREAD, &after);
+    reportJitter(arg, &before, &after);
+}
+
+// Function: Account the delay between the planned end of a sleep and the actual wakeup in the jitter report, and return the time in `now`
+void recordWakeup(pBus arg, const struct timespec *target, struct timespec *now)
+{
+    clock_gettime(CLOCK_MONOTONIC, now);
+    long long latencyNs = diffNanoseconds(now, target);
+    if (latencyNs < 0)
+        latencyNs = 0;
+    int bin = 0;
+    while (bin < JITTER_BINS - 1 && latencyNs >= 1000LL << bin)
+        bin++;
+    arg->latencyHistogram[bin]++;
+    arg->latencySumNs += latencyNs;
+    if (latencyNs > arg->latencyMaxNs)
+        arg->latencyMaxNs = latencyNs;
+    arg->wakeups++;
+}
+
+// Function: Print the wakeup latencies of a bus with the settings of its thread, and what the thread suffered during the loop
+// The involuntary context switches show the preemptions SCHED_FIFO avoids, the page faults the ones `-L` avoids
+void reportJitter(pBus arg, const struct rusage *before, const struct rusage *after)
+{
+    char settings[96] = "default scheduling", cpu[16] = "any CPU";
+    if (arg->priority > 0)
+        snprintf(settings, sizeof(settings), "SCHED_FIFO %d", arg->priority);
+    if (arg->cpu >= 0)
+        snprintf(cpu, sizeof(cpu), "CPU %d", arg->cpu);
+    printf("Bus %d (%s, %s, memory %s): ", arg->busIndex, settings, cpu, memoryLocked ? "locked" : lockMemory ? "prefaulted" : "not locked");
+    if (arg->wakeups > 0)
+    {
+        // The 99th percentile is bounded by the upper edge of the bin where it falls
+        long long p99 = 0, seen = 0;
+        for (int bin = 0; bin < JITTER_BINS && seen * 100 < arg->wakeups * 99; bin++)
+        {
+            seen += arg->latencyHistogram[bin];
+            p99 = 1LL << bin;
+        }
+        printf("%lld wakeups late by %.1f us on average, 99%% by less than %s%lld us, at most %.1f us",
+               arg->wakeups, arg->latencySumNs / 1e3 / arg->wakeups, p99 == 1LL << (JITTER_BINS - 1) ? "about " : "", p99, arg->latencyMaxNs / 1e3);
+    }
+    else
+        printf("no timed wakeup in this mode");
+    printf(", %u CPU migrations, %ld involuntary context switches, %ld minor and %ld major page faults\n", arg->migrations,
+           after->ru_nivcsw - before->ru_nivcsw, after->ru_minflt - before->ru_minflt, after->ru_majflt - before->ru_majflt);
+}
+
+// Thread executed by each I2C bus
+void *busThread(void *arg)
+{
+    // Convert the generic pointer to a bus structure pointer
+    pBus bus = (pBus)arg;
+    if (lockMemory)
+        prefaultStack();
+    // Configure the parameters of every accelerometer on the bus
+    for (int i = 0; i < bus->sensorCount; i++)
+    {
+        pSensor info = bus->sensors[i];
+        if (!info->attached)
+            continue;
+        if (setup(info) == 0)
+        {
+            info->ready = 1;
+            continue;
+        }
+        printf("Sensor %d setup failed. Skipping it.\n", info->sensorIndex);
+        closeEventSource(&info->event);
+    }
+    // Loop to read data
+    loop(bus);
+    // Release the sensors with their interrupt sources, then close the I2C device
+    for (int i = 0; i < bus->sensorCount; i++)
+    {
+        pSensor info = bus->sensors[i];
+        if (info->attached)
+            bus->backend->detach(info);
+        closeEventSource(&info->event);
+    }
+    bus->backend->close(bus);
+    // Exit the thread
+    pthread_exit(NULL);
+}
+
+// Function: Prepare the attributes of a thread: its SCHED_FIFO priority if positive, the CPU it is pinned to if not -1, and a
+// smaller stack with `-L`, since every page of a stack is locked
+void threadAttributes(pthread_attr_t *attr, int priority, int cpu)
+{
+    pthread_attr_init(attr);
+    if (priority > 0)
+    {
+        struct sched_param param = {.sched_priority = priority};
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        pthread_attr_setschedparam(attr, &param);
+    }
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+    if (lockMemory)
+        pthread_attr_setstacksize(attr, RT_STACK_SIZE);
+}
+
+// Function: Create a thread with the attributes of threadAttributes, exit if it cannot be created
+void createThread(pthread_t *thread, const char *name, int priority, int cpu, void *(*start)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    threadAttributes(&attr, priority, cpu);
+    int error = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    if (error == 0)
+        return;
+    if (error == EPERM)
+        printf("Failed to create %s: SCHED_FIFO needs root, CAP_SYS_NICE or a large enough RLIMIT_RTPRIO\n", name);
+    else
+        printf("Failed to create %s: %s\n", name, strerror(error));
+    exit(EXIT_FAILURE);
+}
+
+// Function: Touch the first PREFAULT_STACK bytes of the stack of the calling thread, so that the loop never faults on its stack
+// It is never inlined, its frame must be gone once it returns
+__attribute__((noinline)) void prefaultStack(void)
+{
+    volatile unsigned char stack[PREFAULT_STACK];
+    long page = sysconf(_SC_PAGESIZE);
+    for (long i = 0; i < PREFAULT_STACK; i += page)
+        stack[i] = 0;
+    (void)stack;
 }
@@ -0,0 +1,351 @@
+#ifndef AIS2IH_ARROW_H
+#define AIS2IH_ARROW_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "AIS2IH_format.h"
+
+/*
+Arrow IPC file format of AIS2IH (`-o arrow`), written without the Arrow library.
+An Arrow file is read by pandas (pyarrow.ipc.open_file or pandas.read_feather) and polars (read_ipc) without any parsing,
+and it can be memory-mapped, in which case the columns are used in place. The file holds:
+    "ARROW1" and two bytes of padding
+    the schema message
+    one record batch message per ARROW_BATCH samples, each followed by its body, the columns one after the other
+    the end-of-stream marker
+    the footer, the schema again and the position of every record batch, then its size and "ARROW1"
+Every message is the continuation marker 0xFFFFFFFF, the size of its metadata, the metadata as a flatbuffer of the Arrow
+format (Schema.fbs, Message.fbs and File.fbs), padded to 8 bytes, then the body.
+The columns are one int16 column per recorded axis, named x, y and z, with the values of the CSV output, then the int64
+column `timestamp`, a timestamp in ns since the epoch (UTC) that never decreases. The schema metadata holds the fields of the RecordingHeader
+of the sensor as text, under keys starting with "ais2ih.". The schema of the footer adds "ais2ih.measured_odr_hz", the
+output data rate measured over the whole recording.
+The flatbuffers are built from the end of the buffer towards its start like the flatbuffers library does, so that
+every table is written after the objects it refers to and all its offsets point forward.
+*/
+
+#define ARROW_MAGIC "ARROW1"            // First and last 6 bytes of an Arrow file
+#define ARROW_CONTINUATION 0xFFFFFFFFu  // Start of every encapsulated message
+#define ARROW_VERSION_V5 4              // MetadataVersion of the messages
+#define ARROW_HEADER_SCHEMA 1           // MessageHeader union type of a schema
+#define ARROW_HEADER_RECORD_BATCH 3     // MessageHeader union type of a record batch
+#define ARROW_TYPE_INT 2                // Type union type of an integer column
+#define ARROW_TYPE_TIMESTAMP 10         // Type union type of a timestamp column
+#define ARROW_UNIT_NANOSECOND 3         // TimeUnit of the timestamp column
+#define ARROW_BATCH 32768               // Number of samples of a full record batch
+#define ARROW_MAX_FIELDS 8              // Largest number of fields of a table
+
+// Flatbuffer under construction, it grows from the end of `data` towards its start
+// The position of an object is the number of bytes between it and the end of the buffer
+typedef struct ArrowBuilder
+{
+    unsigned char *data;              // Buffer
+    size_t size;                      // Size of `data`
+    size_t used;                      // Number of bytes used at the end of `data`
+    size_t fields[ARROW_MAX_FIELDS];  // Position of each field of the table under construction, 0 if absent
+    int fieldCount;                   // Highest field index of the table under construction plus one
+    size_t tableStart;                // `used` when the table under construction was started
+} ArrowBuilder;
+
+// Position of a record batch in the file, the Block struct of File.fbs
+typedef struct ArrowBlock
+{
+    int64_t offset;          // Offset of the message from the start of the file
+    int32_t metaDataLength;  // Size of the message up to its body, including the continuation marker and the size
+    int32_t padding;         // 0
+    int64_t bodyLength;      // Size of the body
+} ArrowBlock;
+
+// Function: Make room for `length` more bytes in front of the flatbuffer
+static inline void arrowGrow(ArrowBuilder *b, size_t length)
+{
+    if (b->size - b->used >= length)
+        return;
+    size_t size = b->size * 2 > b->used + length + 256 ? b->size * 2 : b->used + length + 256;
+    unsigned char *data = malloc(size);
+    if (data == NULL)
+    {
+        perror("Failed to allocate an Arrow message");
+        exit(EXIT_FAILURE);
+    }
+    // Keep the bytes at the end of the new buffer
+    if (b->used > 0)
+        memcpy(data + size - b->used, b->data + b->size - b->used, b->used);
+    free(b->data);
+    b->data = data;
+    b->size = size;
+}
+
+// Function: Prepend `length` bytes, zeros if `bytes` is NULL
+static inline void arrowPrepend(ArrowBuilder *b, const void *bytes, size_t length)
+{
+    arrowGrow(b, length);
+    b->used += length;
+    if (bytes != NULL)
+        memcpy(b->data + b->size - b->used, bytes, length);
+    else
+        memset(b->data + b->size - b->used, 0, length);
+}
+
+// Function: Pad so that the next `additional` bytes end aligned to `align` bytes
+static inline void arrowAlign(ArrowBuilder *b, size_t align, size_t additional)
+{
+    arrowPrepend(b, NULL, (align - (b->used + additional) % align) % align);
+}
+
+// Function: Prepend an offset to the object at `target`, it is relative to the offset itself
+static inline void arrowPrependOffset(ArrowBuilder *b, size_t target)
+{
+    arrowAlign(b, 4, 4);
+    uint32_t offset = b->used + 4 - target;
+    arrowPrepend(b, &offset, 4);
+}
+
+// Function: Start a table, its fields are then added in any order
+static inline void arrowStartTable(ArrowBuilder *b)
+{
+    memset(b->fields, 0, sizeof(b->fields));
+    b->fieldCount = 0;
+    b->tableStart = b->used;
+}
+
+// Function: Add the scalar field `id` of `length` bytes to the table under construction
+static inline void arrowAddScalar(ArrowBuilder *b, int id, const void *value, size_t length)
+{
+    arrowAlign(b, length, length);
+    arrowPrepend(b, value, length);
+    b->fields[id] = b->used;
+    b->fieldCount = id + 1 > b->fieldCount ? id + 1 : b->fieldCount;
+}
+
+// Function: Add the field `id`, an offset to the object at `target`, to the table under construction
+static inline void arrowAddOffset(ArrowBuilder *b, int id, size_t target)
+{
+    arrowPrependOffset(b, target);
+    b->fields[id] = b->used;
+    b->fieldCount = id + 1 > b->fieldCount ? id + 1 : b->fieldCount;
+}
+
+// Function: Finish the table under construction, followed by its vtable, and return its position
+static inline size_t arrowEndTable(ArrowBuilder *b)
+{
+    arrowAlign(b, 4, 4);
+    arrowPrepend(b, NULL, 4);
+    size_t table = b->used;
+    // The vtable holds the offset of each field from the start of the table, then the size of the table and its own
+    for (int id = b->fieldCount - 1; id >= 0; id--)
+    {
+        uint16_t offset = b->fields[id] != 0 ? table - b->fields[id] : 0;
+        arrowPrepend(b, &offset, 2);
+    }
+    uint16_t sizes[2] = {4 + 2 * b->fieldCount, table - b->tableStart};
+    arrowPrepend(b, sizes, 4);
+    // The table starts with the distance back to its vtable
+    int32_t vtable = b->used - table;
+    memcpy(b->data + b->size - table, &vtable, 4);
+    return table;
+}
+
+// Function: Prepend a string and return its position
+static inline size_t arrowString(ArrowBuilder *b, const char *text)
+{
+    uint32_t length = strlen(text);
+    arrowAlign(b, 4, length + 1);
+    arrowPrepend(b, NULL, 1);
+    arrowPrepend(b, text, length);
+    arrowPrepend(b, &length, 4);
+    return b->used;
+}
+
+// Function: Prepend a vector of offsets to the objects at `targets` and return its position
+static inline size_t arrowOffsetVector(ArrowBuilder *b, const size_t *targets, int count)
+{
+    arrowAlign(b, 4, 4 * count);
+    for (int i = count - 1; i >= 0; i--)
+        arrowPrependOffset(b, targets[i]);
+    uint32_t length = count;
+    arrowPrepend(b, &length, 4);
+    return b->used;
+}
+
+// Function: Prepend a vector of `count` structs of `length` bytes aligned to 8 bytes and return its position
+static inline size_t arrowStructVector(ArrowBuilder *b, const void *structs, int count, size_t length)
+{
+    arrowAlign(b, 4, length * count);
+    arrowAlign(b, 8, length * count);
+    arrowPrepend(b, structs, length * count);
+    uint32_t vectorLength = count;
+    arrowPrepend(b, &vectorLength, 4);
+    return b->used;
+}
+
+// Function: Finish the flatbuffer with its root table, return its start, the flatbuffer is the last `b->used` bytes
+static inline unsigned char *arrowFinish(ArrowBuilder *b, size_t root)
+{
+    arrowAlign(b, 8, 4);
+    arrowPrependOffset(b, root);
+    return b->data + b->size - b->used;
+}
+
+// Function: Prepend a Field table of an int16 or a timestamp column and return its position
+static inline size_t arrowField(ArrowBuilder *b, const char *name, int timestamp)
+{
+    size_t nameString = arrowString(b, name);
+    size_t type;
+    if (timestamp)
+    {
+        size_t timezone = arrowString(b, "UTC");
+        int16_t unit = ARROW_UNIT_NANOSECOND;
+        arrowStartTable(b);
+        arrowAddOffset(b, 1, timezone);
+        arrowAddScalar(b, 0, &unit, 2);
+        type = arrowEndTable(b);
+    }
+    else
+    {
+        int32_t bitWidth = 16;
+        uint8_t isSigned = 1;
+        arrowStartTable(b);
+        arrowAddScalar(b, 0, &bitWidth, 4);
+        arrowAddScalar(b, 1, &isSigned, 1);
+        type = arrowEndTable(b);
+    }
+    size_t children = arrowOffsetVector(b, NULL, 0);
+    uint8_t typeType = timestamp ? ARROW_TYPE_TIMESTAMP : ARROW_TYPE_INT, nullable = 0;
+    arrowStartTable(b);
+    arrowAddOffset(b, 0, nameString);
+    arrowAddOffset(b, 3, type);
+    arrowAddOffset(b, 5, children);
+    arrowAddScalar(b, 1, &nullable, 1);
+    arrowAddScalar(b, 2, &typeType, 1);
+    return arrowEndTable(b);
+}
+
+// Function: Prepend a KeyValue table of the schema metadata and return its position
+static inline size_t arrowKeyValue(ArrowBuilder *b, const char *key, const char *value)
+{
+    size_t keyString = arrowString(b, key);
+    size_t valueString = arrowString(b, value);
+    arrowStartTable(b);
+    arrowAddOffset(b, 0, keyString);
+    arrowAddOffset(b, 1, valueString);
+    return arrowEndTable(b);
+}
+
+// Function: Prepend the Schema table of a recording described by `header` and return its position
+// The measured output data rate is added to the metadata unless it is 0
+static inline size_t arrowSchema(ArrowBuilder *b, const RecordingHeader *header, double measuredOdrHz)
+{
+    // One int16 column per recorded axis, then the timestamps
+    size_t fields[4];
+    int fieldCount = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (header->axes & (1 << axis))
+            fields[fieldCount++] = arrowField(b, axis == 0 ? "x" : axis == 1 ? "y" : "z", 0);
+    }
+    fields[fieldCount++] = arrowField(b, "timestamp", 1);
+    size_t fieldVector = arrowOffsetVector(b, fields, fieldCount);
+    // The configuration of the sensor, as in the header of the binary recordings
+    char values[13][80];
+    snprintf(values[0], sizeof(values[0]), "%u", header->sensorIndex);
+    snprintf(values[1], sizeof(values[1]), "%.64s", header->bus);
+    snprintf(values[2], sizeof(values[2]), "0x%02x", header->address);
+    snprintf(values[3], sizeof(values[3]), "%g", header->odrMilliHz / 1000.0);
+    snprintf(values[4], sizeof(values[4]), "%.8s", header->powerMode);
+    snprintf(values[5], sizeof(values[5]), "%u", header->fullScale);
+    snprintf(values[6], sizeof(values[6]), "%u", header->resolution);
+    snprintf(values[7], sizeof(values[7]), "%s%s%s", header->axes & 1 ? "x" : "", header->axes & 2 ? "y" : "", header->axes & 4 ? "z" : "");
+    snprintf(values[8], sizeof(values[8]), "%u", header->watermark);
+    snprintf(values[9], sizeof(values[9]), "%lld", (long long)header->startRealtimeNs);
+    snprintf(values[10], sizeof(values[10]), "%lld", (long long)header->startMonotonicNs);
+    snprintf(values[11], sizeof(values[11]), "%llu", (unsigned long long)header->firstSample);
+    snprintf(values[12], sizeof(values[12]), "%.6f", measuredOdrHz);
+    static const char *const keys[13] = {"ais2ih.sensor", "ais2ih.bus", "ais2ih.address", "ais2ih.odr_hz", "ais2ih.power_mode", "ais2ih.full_scale_g",
+                                         "ais2ih.resolution_bits", "ais2ih.axes", "ais2ih.watermark", "ais2ih.start_realtime_ns",
+                                         "ais2ih.start_monotonic_ns", "ais2ih.first_sample", "ais2ih.measured_odr_hz"};
+    int pairCount = measuredOdrHz > 0 ? 13 : 12;
+    size_t pairs[13];
+    for (int i = 0; i < pairCount; i++)
+        pairs[i] = arrowKeyValue(b, keys[i], values[i]);
+    size_t metadata = arrowOffsetVector(b, pairs, pairCount);
+    arrowStartTable(b);
+    arrowAddOffset(b, 1, fieldVector);
+    arrowAddOffset(b, 2, metadata);
+    return arrowEndTable(b);
+}
+
+// Function: Build the Message table holding `header`, return the start of the flatbuffer, its size is then `b->used`
+static inline unsigned char *arrowMessage(ArrowBuilder *b, uint8_t headerType, size_t header, int64_t bodyLength)
+{
+    int16_t version = ARROW_VERSION_V5;
+    arrowStartTable(b);
+    arrowAddScalar(b, 3, &bodyLength, 8);
+    arrowAddOffset(b, 2, header);
+    arrowAddScalar(b, 0, &version, 2);
+    arrowAddScalar(b, 1, &headerType, 1);
+    return arrowFinish(b, arrowEndTable(b));
+}
+
+// Function: Return the size of a column of `length` bytes in a record batch body, padded to 8 bytes
+static inline int64_t arrowPadded(int64_t length)
+{
+    return (length + 7) & ~(int64_t)7;
+}
+
+// Function: Build the schema message of a recording described by `header`, return the start of the flatbuffer
+static inline unsigned char *arrowSchemaMessage(ArrowBuilder *b, const RecordingHeader *header)
+{
+    b->used = 0;
+    return arrowMessage(b, ARROW_HEADER_SCHEMA, arrowSchema(b, header, 0), 0);
+}
+
+// Function: Build the message of a record batch of `rows` samples of `channels` values and their timestamps,
+// return the start of the flatbuffer and the size of the body in `bodyLength`
+static inline unsigned char *arrowBatchMessage(ArrowBuilder *b, int64_t rows, int channels, int64_t *bodyLength)
+{
+    // Every column has an empty validity bitmap, since no value is null, then its values
+    int64_t nodes[2 * 4], buffers[4 * 4];
+    int64_t offset = 0;
+    for (int c = 0; c <= channels; c++)
+    {
+        int64_t length = c < channels ? rows * 2 : rows * 8;
+        nodes[2 * c] = rows;
+        nodes[2 * c + 1] = 0;
+        buffers[4 * c] = offset;
+        buffers[4 * c + 1] = 0;
+        buffers[4 * c + 2] = offset;
+        buffers[4 * c + 3] = length;
+        offset += arrowPadded(length);
+    }
+    *bodyLength = offset;
+    b->used = 0;
+    size_t nodeVector = arrowStructVector(b, nodes, channels + 1, 16);
+    size_t bufferVector = arrowStructVector(b, buffers, 2 * (channels + 1), 16);
+    arrowStartTable(b);
+    arrowAddScalar(b, 0, &rows, 8);
+    arrowAddOffset(b, 1, nodeVector);
+    arrowAddOffset(b, 2, bufferVector);
+    return arrowMessage(b, ARROW_HEADER_RECORD_BATCH, arrowEndTable(b), offset);
+}
+
+// Function: Build the footer of a recording described by `header` with `count` record batches and the output data rate
+// measured over them, return the start of the flatbuffer
+static inline unsigned char *arrowFooter(ArrowBuilder *b, const RecordingHeader *header, double measuredOdrHz, const ArrowBlock *blocks, int count)
+{
+    b->used = 0;
+    size_t schema = arrowSchema(b, header, measuredOdrHz);
+    size_t dictionaries = arrowStructVector(b, NULL, 0, sizeof(ArrowBlock));
+    size_t batches = arrowStructVector(b, blocks, count, sizeof(ArrowBlock));
+    int16_t version = ARROW_VERSION_V5;
+    arrowStartTable(b);
+    arrowAddOffset(b, 1, schema);
+    arrowAddOffset(b, 2, dictionaries);
+    arrowAddOffset(b, 3, batches);
+    arrowAddScalar(b, 0, &version, 2);
+    return arrowFinish(b, arrowEndTable(b));
+}
+
+#endif
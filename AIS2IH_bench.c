@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "AIS2IH_csv.h"
+#include "AIS2IH_codec.h"
+
+/*
+Microbenchmark of the CSV output and of the compression codec of AIS2IH.
+It formats the same synthetic samples with the former path, one fprintf per sample into a stdio stream,
+and with formatCsv into one buffer written with a single write() when full, and reports the time of both.
+It first checks that both produce the same bytes for every int16 value, and for every number of channels.
+Then it compresses the samples in blocks of CODEC_FRAME, checks that both decoders restore them exactly,
+and reports the compression ratio and the time of the scalar and the vectorized decoder.
+The number of samples (default 4000000) can be passed as the argument.
+Example: ./AIS2IH_bench 10000000
+*/
+
+#define BENCH_BLOCK 32          // Samples per block, as one FIFO drain
+#define BENCH_BUFFER (1 << 20)  // Buffer of the formatted text, as WRITER_BUFFER
+
+// Function prototypes
+double seconds(void);                                                     // Return the monotonic time in seconds
+int checkIdentical(void);                                                 // Compare formatCsv with sprintf for every value, return 0 if identical
+double benchFprintf(const short *samples, long count, const char *path);  // Time the former per-sample fprintf path
+double benchFormatCsv(const short *samples, long count, const char *path); // Time formatCsv into a buffer written by write()
+int benchCodec(const short *samples, long count);                         // Check and time the codec, return 0 if it is lossless
+
+int main(int argc, char *argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 4000000;
+    if (checkIdentical() != 0)
+        return EXIT_FAILURE;
+    // A random walk around 1 g on Z, close to what the sensor records
+    short *samples = malloc(count * 3 * sizeof(short));
+    if (samples == NULL)
+    {
+        perror("Failed to allocate samples");
+        return EXIT_FAILURE;
+    }
+    int x = 0, y = 0, z = 4096;
+    srand(1);
+    for (long i = 0; i < count; i++)
+    {
+        x += rand() % 65 - 32;
+        y += rand() % 65 - 32;
+        z += rand() % 65 - 32;
+        samples[3 * i] = x;
+        samples[3 * i + 1] = y;
+        samples[3 * i + 2] = z;
+    }
+    double old = benchFprintf(samples, count, "/dev/null");
+    double fast = benchFormatCsv(samples, count, "/dev/null");
+    printf("fprintf:   %.3f s, %.1f Msamples/s\n", old, count / old / 1e6);
+    printf("formatCsv: %.3f s, %.1f Msamples/s\n", fast, count / fast / 1e6);
+    printf("speedup:   %.1fx\n", old / fast);
+    int ret = benchCodec(samples, count);
+    free(samples);
+    return ret;
+}
+
+// Function: Return the monotonic time in seconds
+double seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Function: Compare formatCsv with sprintf for every int16 value and every number of channels, return 0 if identical
+int checkIdentical(void)
+{
+    char fast[BENCH_BLOCK * 3 * CSV_VALUE_MAX], slow[BENCH_BLOCK * 3 * CSV_VALUE_MAX + 1];
+    short samples[3];
+    for (int value = -32768; value <= 32767; value++)
+    {
+        for (int channels = 1; channels <= 3; channels++)
+        {
+            // The neighbours of the value take the other columns
+            samples[0] = value;
+            samples[1] = -value - 1;
+            samples[2] = value / 7;
+            int length = formatCsv(fast, samples, 1, channels);
+            int expected = channels == 3   ? sprintf(slow, "%d,%d,%d\n", samples[0], samples[1], samples[2])
+                           : channels == 2 ? sprintf(slow, "%d,%d\n", samples[0], samples[1])
+                                           : sprintf(slow, "%d\n", samples[0]);
+            if (length != expected || memcmp(fast, slow, length) != 0)
+            {
+                printf("Error! formatCsv differs from fprintf for %d with %d channels!\n", value, channels);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Function: Time the former path, one fprintf per sample into a fully buffered stdio stream
+double benchFprintf(const short *samples, long count, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(file, NULL, _IOFBF, BENCH_BUFFER);
+    double start = seconds();
+    for (long i = 0; i < count; i++)
+        fprintf(file, "%d,%d,%d\n", samples[3 * i], samples[3 * i + 1], samples[3 * i + 2]);
+    fclose(file);
+    return seconds() - start;
+}
+
+// Function: Time formatCsv, formatting blocks of BENCH_BLOCK samples into one buffer that is written with a single write() when full
+double benchFormatCsv(const short *samples, long count, const char *path)
+{
+    int fd = open(path, O_WRONLY);
+    char *buffer = malloc(BENCH_BUFFER);
+    if (fd == -1 || buffer == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    double start = seconds();
+    size_t used = 0;
+    for (long i = 0; i < count; i += BENCH_BLOCK)
+    {
+        int block = count - i < BENCH_BLOCK ? count - i : BENCH_BLOCK;
+        if (used + block * 3 * CSV_VALUE_MAX > BENCH_BUFFER)
+        {
+            if (write(fd, buffer, used) != (ssize_t)used)
+                perror(path);
+            used = 0;
+        }
+        used += formatCsv(buffer + used, samples + 3 * i, block, 3);
+    }
+    if (write(fd, buffer, used) != (ssize_t)used)
+        perror(path);
+    close(fd);
+    free(buffer);
+    return seconds() - start;
+}
+
+// Function: Compress the samples in blocks of CODEC_FRAME, check that both decoders restore them, and time the decoders
+int benchCodec(const short *samples, long count)
+{
+    long blocks = (count + CODEC_FRAME - 1) / CODEC_FRAME;
+    unsigned char *packed = malloc(blocks * codecBound(CODEC_FRAME, 3));
+    int *sizes = malloc(blocks * sizeof(int));
+    short *decoded = malloc(count * 3 * sizeof(short));
+    if (packed == NULL || sizes == NULL || decoded == NULL)
+    {
+        perror("Failed to allocate the codec buffers");
+        exit(EXIT_FAILURE);
+    }
+    double start = seconds();
+    size_t total = 0;
+    for (long b = 0; b < blocks; b++)
+    {
+        int block = count - b * CODEC_FRAME < CODEC_FRAME ? count - b * CODEC_FRAME : CODEC_FRAME;
+        sizes[b] = codecEncode(packed + total, samples + 3 * b * CODEC_FRAME, block, 3);
+        total += sizes[b];
+    }
+    double encode = seconds() - start;
+    // Time both decoders, and check the samples after each
+    double decode[2];
+    for (int vectorized = 0; vectorized < 2; vectorized++)
+    {
+        memset(decoded, 0, count * 3 * sizeof(short));
+        start = seconds();
+        size_t offset = 0;
+        for (long b = 0; b < blocks; b++)
+        {
+            int block = count - b * CODEC_FRAME < CODEC_FRAME ? count - b * CODEC_FRAME : CODEC_FRAME;
+            if (vectorized)
+                codecDecode(packed + offset, sizes[b], decoded + 3 * b * CODEC_FRAME, block, 3);
+            else
+                codecDecodeScalar(packed + offset, sizes[b], decoded + 3 * b * CODEC_FRAME, block, 3);
+            offset += sizes[b];
+        }
+        decode[vectorized] = seconds() - start;
+        if (memcmp(decoded, samples, count * 3 * sizeof(short)) != 0)
+        {
+            printf("Error! The %s decoder does not restore the samples!\n", vectorized ? "vectorized" : "scalar");
+            return 1;
+        }
+    }
+    printf("codec:     %.1f%% of the int16 size, encoding %.1f Msamples/s\n", 100.0 * total / (count * 3 * sizeof(short)), count / encode / 1e6);
+    printf("decoding:  scalar %.1f Msamples/s, vectorized %.1f Msamples/s\n", count / decode[0] / 1e6, count / decode[1] / 1e6);
+    free(packed);
+    free(sizes);
+    free(decoded);
+    return 0;
+}
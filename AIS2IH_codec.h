@@ -0,0 +1,130 @@
+#ifndef AIS2IH_CODEC_H
+#define AIS2IH_CODEC_H
+
+#include <stdint.h>
+#include "AIS2IH_format.h"
+
+/*
+Lossless codec of the CODEC_DELTA_PACK recordings, shared by AIS2IH, AIS2IH_read and AIS2IH_bench.
+The layout of a block is described in AIS2IH_format.h. Consecutive samples of an accelerometer differ by a few LSB,
+so the zigzag-mapped deltas usually fit in a handful of bits instead of 16.
+The deltas are bit-sliced in groups of eight so that the decoder works on a whole group at a time with the vector
+extensions of GCC and Clang, which map to NEON or SSE/AVX: every byte is spread over the eight lanes, the zigzag
+mapping is undone lane-wise, and the deltas are summed with a log-step prefix sum inside the vector.
+*/
+
+typedef int32_t codecVector __attribute__((vector_size(32)));   // Eight deltas
+typedef uint32_t codecUVector __attribute__((vector_size(32))); // Eight zigzag-mapped deltas
+
+#ifdef __clang__
+#define CODEC_SHUFFLE(a, b, ...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define CODEC_SHUFFLE(a, b, ...) __builtin_shuffle(a, b, (codecVector){__VA_ARGS__})
+#endif
+
+// Function: Return the largest encoded size of `count` samples of `channels` values
+static inline int codecBound(int count, int channels)
+{
+    return channels * (3 + (count + 6) / 8 * 17);
+}
+
+// Function: Encode `count` samples, 1 to CODEC_FRAME, of `channels` interleaved values into `out`, return the encoded size
+static inline int codecEncode(unsigned char *out, const short *samples, int count, int channels)
+{
+    unsigned char *p = out;
+    for (int c = 0; c < channels; c++)
+    {
+        // Zigzag-map the deltas, and find the width of the largest one
+        uint32_t zigzag[CODEC_FRAME + 7] = {0};
+        uint32_t all = 0;
+        for (int i = 1; i < count; i++)
+        {
+            int32_t delta = samples[i * channels + c] - samples[(i - 1) * channels + c];
+            zigzag[i - 1] = (uint32_t)delta << 1 ^ (uint32_t)(delta >> 31);
+            all |= zigzag[i - 1];
+        }
+        int width = all != 0 ? 32 - __builtin_clz(all) : 0;
+        uint16_t first = samples[c];
+        *p++ = first & 0xFF;
+        *p++ = first >> 8;
+        *p++ = width;
+        // Slice every group of eight deltas into `width` bytes, one per bit
+        for (int i = 0; i < count - 1; i += 8)
+        {
+            for (int bit = 0; bit < width; bit++)
+            {
+                unsigned char byte = 0;
+                for (int k = 0; k < 8; k++)
+                    byte |= (zigzag[i + k] >> bit & 1) << k;
+                *p++ = byte;
+            }
+        }
+    }
+    return p - out;
+}
+
+// Function: Decode one delta at a time, the reference of codecDecode, return the size of the block or -1 if it is damaged
+static inline int codecDecodeScalar(const unsigned char *in, int size, short *samples, int count, int channels)
+{
+    const unsigned char *p = in;
+    for (int c = 0; c < channels; c++)
+    {
+        if (p + 3 > in + size || p[2] > 17 || p + 3 + (count + 6) / 8 * p[2] > in + size)
+            return -1;
+        int width = p[2];
+        int32_t value = (int16_t)(p[0] | p[1] << 8);
+        p += 3;
+        samples[c] = value;
+        for (int i = 1; i < count; i++)
+        {
+            const unsigned char *group = p + (i - 1) / 8 * width;
+            uint32_t zigzag = 0;
+            for (int bit = 0; bit < width; bit++)
+                zigzag |= (uint32_t)(group[bit] >> ((i - 1) % 8) & 1) << bit;
+            value += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            samples[i * channels + c] = value;
+        }
+        p += (count + 6) / 8 * width;
+    }
+    return p - in;
+}
+
+// Function: Decode a block of `count` samples of `channels` values from the `size` bytes at `in`,
+// return the size of the block or -1 if it is damaged
+static inline int codecDecode(const unsigned char *in, int size, short *samples, int count, int channels)
+{
+    const unsigned char *p = in;
+    const codecVector zero = {0};
+    const codecUVector lanes = {0, 1, 2, 3, 4, 5, 6, 7};
+    for (int c = 0; c < channels; c++)
+    {
+        if (p + 3 > in + size || p[2] > 17 || p + 3 + (count + 6) / 8 * p[2] > in + size)
+            return -1;
+        int width = p[2];
+        int32_t first = (int16_t)(p[0] | p[1] << 8);
+        p += 3;
+        samples[c] = first;
+        codecVector running = zero + first;
+        for (int i = 0; i < count - 1; i += 8)
+        {
+            // Spread bit k of every byte to lane k
+            codecUVector zigzag = (codecUVector)zero;
+            for (int bit = 0; bit < width; bit++)
+                zigzag |= (((codecUVector)zero + *p++) >> lanes & 1) << bit;
+            // Undo the zigzag mapping, then add up the deltas: after the three steps, lane k holds the sum of lanes 0 to k
+            codecVector delta = (codecVector)(zigzag >> 1) ^ -(codecVector)(zigzag & 1);
+            delta += CODEC_SHUFFLE(delta, zero, 8, 0, 1, 2, 3, 4, 5, 6);
+            delta += CODEC_SHUFFLE(delta, zero, 8, 8, 0, 1, 2, 3, 4, 5);
+            delta += CODEC_SHUFFLE(delta, zero, 8, 8, 8, 8, 0, 1, 2, 3);
+            codecVector value = running + delta;
+            int used = count - 1 - i < 8 ? count - 1 - i : 8;
+            for (int lane = 0; lane < used; lane++)
+                samples[(i + lane + 1) * channels + c] = value[lane];
+            // Carry the last value into every lane of the next group
+            running = CODEC_SHUFFLE(value, value, 7, 7, 7, 7, 7, 7, 7, 7);
+        }
+    }
+    return p - in;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef AIS2IH_CSV_H
+#define AIS2IH_CSV_H
+
+#include <string.h>
+
+/*
+CSV formatting of AIS2IH, shared by the acquisition and its benchmark (AIS2IH_bench).
+The text is byte-identical to one fprintf(file, "%d,%d,%d\n", ...) per sample, with one to three values per line,
+but a whole block is formatted into one buffer with a table of two-digit pairs instead of a division per digit.
+*/
+
+#define CSV_VALUE_MAX 7 // Longest value, "-32768", with its separator
+
+// Two-digit pairs "00" to "99"
+static const char csvDigitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869"
+    "707172737475767778798081828384858687888990919293949596979899";
+
+// Function: Write a sample value in decimal to `out`, return the end of the text
+static inline char *csvInteger(char *out, int value)
+{
+    unsigned v = value;
+    if (value < 0)
+    {
+        *out++ = '-';
+        v = -(unsigned)value;
+    }
+    // Find the number of digits, then fill them in from the end two at a time
+    char *end = out + (v < 10 ? 1 : v < 100 ? 2 : v < 1000 ? 3 : v < 10000 ? 4 : 5);
+    char *p = end;
+    while (v >= 100)
+    {
+        unsigned q = v / 100;
+        p -= 2;
+        memcpy(p, csvDigitPairs + 2 * (v - 100 * q), 2);
+        v = q;
+    }
+    if (v >= 10)
+        memcpy(p - 2, csvDigitPairs + 2 * v, 2);
+    else
+        p[-1] = '0' + v;
+    return end;
+}
+
+// Function: Format `count` samples of `channels` values into `out`, which must hold `count * channels * CSV_VALUE_MAX` bytes, return the length
+static inline int formatCsv(char *out, const short *samples, int count, int channels)
+{
+    char *p = out;
+    for (int i = 0; i < count; i++)
+    {
+        // Keep the "x,y,z" layout, or the recorded axes in that order
+        for (int c = 0; c < channels; c++)
+        {
+            p = csvInteger(p, *samples++);
+            *p++ = c + 1 < channels ? ',' : '\n';
+        }
+    }
+    return p - out;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef AIS2IH_FORMAT_H
+#define AIS2IH_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Binary recording format of AIS2IH (`-o bin`), read back by AIS2IH_read.
+
+A recording is one RecordingHeader followed by blocks. Every block is a BlockHeader followed by `sampleCount` samples,
+each made of `channels` values in x, y, z order (only the recorded axes, see `axes`). The values are the
+converted samples, i.e. the same numbers the CSV output holds. All fields are little-endian.
+With CODEC_RAW, the samples are stored as int16. With CODEC_DELTA_PACK (`-o packed`), each block holds up to
+CODEC_FRAME samples in `payloadSize` bytes, with the following for each channel:
+    int16   the first value
+    uint8   the width W of the deltas in bits, 0 to 17
+    the `sampleCount - 1` differences between consecutive values, zigzag-mapped to unsigned (0, -1, 1, -2, ... become
+    0, 1, 2, 3, ...) and packed in groups of eight: a group takes W bytes, bit k of byte b is bit b of the k-th
+    difference of the group, and the last group is completed with zeros.
+The blocks are independent, so a damaged or truncated recording can be decoded up to the damage.
+A block with a `sampleCount` of 0 is a gap record: the `payloadSize` samples from `firstSample` on were lost, overwritten
+in the FIFO of the sensor before they were read or dropped because the writer fell behind, and no samples follow it.
+Readers must skip `headerSize` bytes to reach the first block, so fields can be appended to the header.
+
+A session recording (`-U`) holds all the sensors of an acquisition in one file. It starts with a SessionHeader, followed
+by one RecordingHeader per sensor, each `headerSize` bytes long, then by the blocks of all sensors interleaved.
+Every block is a SessionBlockHeader, naming its sensor and the time it was read, followed by the samples as above,
+encoded with the codec of that sensor's RecordingHeader. The blocks are written in the order of their timestamps, so
+a reader streams every channel in time order with a single sequential scan. With CODEC_DELTA_PACK, every block
+holds the samples of one read, instead of up to CODEC_FRAME samples, to keep that order.
+
+The index of a recording (`-I`), FILE.idx next to the csv or binary file FILE, is an IndexHeader followed by one IndexEntry
+about every `intervalMs` of the recording, in time order. An entry points at the first byte of a block of the file: a
+BlockHeader, a SessionBlockHeader, or the first CSV line of the block. A reader finds the entry preceding a time with a
+binary search, seeks to its offset and reads on from there, whatever the length of the recording.
+
+Every recording, whatever its format, has a time file, FILE.time next to FILE. It is a TimeHeader, one TimeStart per
+sensor of the recording, i.e. one unless it is a session recording, then one TimeRecord per batch of samples, i.e. per
+FIFO drain or per ring block in poll mode, in the order they were written. A record holds the CLOCK_MONOTONIC_RAW and
+CLOCK_REALTIME times at which the FIFO reported the batch, before it was read, and the sample period estimated on
+CLOCK_MONOTONIC_RAW at that moment. The last sample of a batch is dated at the read time, and sample k of a batch of n samples at
+`realtimeNs - (n - 1 - k) * periodNs`, which costs 32 bytes per batch instead of 8 per sample.
+All sensors of an acquisition are started together, and the TimeStart of a sensor dates its first sample from the
+moment it was started. The oscillator of every sensor deviates from its nominal rate, so the period of each one is
+measured as the acquisition goes on, by a least-squares fit of the read time of its batches against their number of
+samples, which starts a new intercept after every gap since the size of a FIFO overrun is only estimated, and the
+TimeStart holds the last estimate when the file is closed, or the nominal period if the read times did not fit a
+steady rate. Sample n of a sensor is then at
+`firstRawNs + n * periodFs / 10^6`, free of the jitter of the reads, which relates the samples of different sensors to
+a small fraction of their period.
+
+The pyramid of a recording (`-P`), FILE.pyr, holds the minimum, maximum and mean of every axis over runs of samples at
+power-of-two lengths, to draw any zoom level of a long recording from a few kilobytes. It is a PyramidHeader, then the
+records of each level, each level in its own region of the file, whose position and current number of records the
+header lists. A record of level k covers 2^(baseShift + k) consecutive samples, record i starting with sample
+`firstSample + i * 2^(baseShift + k)`, and holds for each channel the int16 minimum, maximum and rounded mean. The last
+record of a level may cover fewer samples, see `sampleCount`. The lost samples of a gap keep their place: a record
+aggregates the samples around a gap, and a record lost whole is empty, with a minimum of INT16_MAX above a maximum of
+INT16_MIN and a mean of 0. The regions are sized for the planned length of the
+file and left with holes at their end while it is written, they are closed up when the file is complete. The header
+is rewritten as records are added, so a pyramid can be read while its recording goes on.
+*/
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary recording format is written in the byte order of a little-endian host"
+#endif
+
+#define RECORDING_MAGIC "AIS2IHB"   // First 8 bytes of a recording, including the terminating null
+#define INDEX_MAGIC "AIS2IHX"       // First 8 bytes of an index, including the terminating null
+#define PYRAMID_MAGIC "AIS2IHP"     // First 8 bytes of a pyramid, including the terminating null
+#define TIME_MAGIC "AIS2IHT"        // First 8 bytes of a time file, including the terminating null
+#define SESSION_MAGIC "AIS2IHS"     // First 8 bytes of a session recording, including the terminating null
+#define RECORDING_VERSION 1         // Incremented on incompatible changes of the layout
+#define CODEC_RAW 0                 // Samples stored as int16
+#define CODEC_DELTA_PACK 1          // Samples stored as per-channel deltas, zigzag-mapped and bit-packed
+#define CODEC_FRAME 128             // Largest number of samples in a CODEC_DELTA_PACK block
+#define PYRAMID_LEVELS 32           // Largest number of levels of a pyramid
+
+// Header at the start of a recording, describing the sensor and its configuration
+typedef struct RecordingHeader
+{
+    char magic[8];              // RECORDING_MAGIC
+    uint16_t version;           // RECORDING_VERSION
+    uint16_t headerSize;        // Size of the header in bytes, the first block starts here
+    uint16_t sensorIndex;       // Index of the sensor in the acquisition
+    uint16_t address;           // Slave address on the bus
+    char bus[64];               // Path of the bus device, e.g. /dev/i2c-1
+    char powerMode[8];          // Name of the power mode, e.g. hp or lp1
+    uint32_t odrMilliHz;        // Output data rate in mHz
+    uint16_t fullScale;         // Full-scale in g
+    uint8_t resolution;         // Number of significant bits of the stored values
+    uint8_t axes;               // Bit mask of the recorded axes, 1 = X, 2 = Y, 4 = Z
+    uint8_t channels;           // Number of values per sample, i.e. the number of bits set in `axes`
+    uint8_t watermark;          // FIFO threshold the sensor was drained at
+    uint16_t codec;             // Encoding of the samples, CODEC_RAW or CODEC_DELTA_PACK
+    uint32_t reserved;          // 0, aligns `startRealtimeNs` to 8 bytes
+    int64_t startRealtimeNs;    // CLOCK_REALTIME at the start of the acquisition, in ns since the epoch
+    int64_t startMonotonicNs;   // CLOCK_MONOTONIC at the same moment, to relate the recordings of one run
+    uint64_t firstSample;       // Index of the first sample of the file since the start of the acquisition, see `-R` and `-T`
+} RecordingHeader;
+
+// The layout is written as is, so it must not depend on the padding rules of the compiler
+_Static_assert(offsetof(RecordingHeader, startRealtimeNs) == 104, "RecordingHeader has implicit padding");
+_Static_assert(offsetof(RecordingHeader, firstSample) == 120, "RecordingHeader has implicit padding");
+_Static_assert(sizeof(RecordingHeader) == 128, "RecordingHeader has implicit padding");
+
+// Header of a block of samples, usually the samples of one FIFO drain
+typedef struct BlockHeader
+{
+    uint64_t firstSample;       // Index of the first sample of the block since the start of the acquisition
+    uint32_t sampleCount;       // Number of samples following the header, 0 for a gap record
+    uint32_t payloadSize;       // Size of the encoded samples in bytes, 0 with CODEC_RAW, the number of lost samples for a gap record
+} BlockHeader;
+
+// Header at the start of a session recording, followed by the RecordingHeader of each sensor
+typedef struct SessionHeader
+{
+    char magic[8];              // SESSION_MAGIC
+    uint16_t version;           // RECORDING_VERSION
+    uint16_t headerSize;        // Size of the header in bytes, the RecordingHeader of the first sensor starts here
+    uint16_t sensorCount;       // Number of sensors, i.e. of RecordingHeaders
+    uint16_t reserved;          // 0
+    int64_t startRealtimeNs;    // CLOCK_REALTIME at the start of the acquisition, in ns since the epoch
+    int64_t startMonotonicNs;   // CLOCK_MONOTONIC at the same moment, the time base of the block timestamps
+} SessionHeader;
+
+// Header of a block of a session recording
+typedef struct SessionBlockHeader
+{
+    int64_t timestampNs;        // CLOCK_MONOTONIC when the block was read, i.e. shortly after its last sample was converted
+    uint16_t sensor;            // Position of the RecordingHeader of the sensor in the session header
+    uint16_t reserved[3];       // 0
+    BlockHeader block;          // Samples of the block, `block.firstSample` counts the samples of this sensor only
+} SessionBlockHeader;
+
+// Header at the start of an index
+typedef struct IndexHeader
+{
+    char magic[8];              // INDEX_MAGIC
+    uint16_t version;           // RECORDING_VERSION
+    uint16_t headerSize;        // Size of the header in bytes, the first entry starts here
+    uint32_t intervalMs;        // Time between two entries
+    uint32_t odrMilliHz;        // Output data rate of the sensor in mHz, 0 for a session recording
+    uint8_t channels;           // Number of values per sample, 0 for a session recording
+    uint8_t reserved[3];        // 0
+    int64_t startMonotonicNs;   // CLOCK_MONOTONIC when the file was opened
+} IndexHeader;
+
+// Entry of an index
+typedef struct IndexEntry
+{
+    int64_t timestampNs;        // CLOCK_MONOTONIC time of sample `firstSample`, derived from the read time of its block and the
+                                // nominal period, or the read time of the block in a session recording
+    uint64_t firstSample;       // Index of the first sample of the block since the start of the acquisition, or in a session
+                                // recording the number of blocks before it, gap records aside, i.e. the position of its record in
+                                // the time file
+    uint64_t offset;            // Offset of the block from the start of the file
+} IndexEntry;
+
+// Header at the start of a time file
+typedef struct TimeHeader
+{
+    char magic[8];              // TIME_MAGIC
+    uint16_t version;           // RECORDING_VERSION
+    uint16_t headerSize;        // Size of the header and the TimeStart in bytes, the first record starts here
+    uint32_t odrMilliHz;        // Nominal output data rate of the sensor in mHz, 0 for a session recording
+    uint16_t sensorCount;       // Number of TimeStart following the header, in the order of the sensors of a session recording
+    uint16_t reserved[3];       // 0
+} TimeHeader;
+
+// Start of a sensor, after the header of a time file
+typedef struct TimeStart
+{
+    int64_t firstRawNs;         // CLOCK_MONOTONIC_RAW of the first sample, one nominal period after the sensor was started,
+                                // 0 if it was not
+    int64_t firstRealtimeNs;    // The same on CLOCK_REALTIME
+    uint64_t periodFs;          // Sample period in fs measured on CLOCK_MONOTONIC_RAW until the file was closed, the nominal one
+                                // before a second of samples, 0 if the file was not closed
+} TimeStart;
+
+// Times of a batch of samples
+typedef struct TimeRecord
+{
+    uint64_t firstSample;       // Index of the first sample of the batch since the start of the acquisition
+    uint16_t sampleCount;       // Number of samples of the batch
+    uint16_t sensor;            // Sensor of the batch in a session recording, its index otherwise
+    uint32_t periodNs;          // Sample period measured on CLOCK_MONOTONIC_RAW since the start of the acquisition, rounded
+    int64_t rawNs;              // CLOCK_MONOTONIC_RAW right after the batch was read
+    int64_t realtimeNs;         // CLOCK_REALTIME at the same moment, in ns since the epoch
+} TimeRecord;
+
+// Position of the records of one level of a pyramid
+typedef struct PyramidLevel
+{
+    uint64_t offset;            // Offset of the first record from the start of the file
+    uint64_t count;             // Number of records written
+} PyramidLevel;
+
+// Header at the start of a pyramid
+typedef struct PyramidHeader
+{
+    char magic[8];              // PYRAMID_MAGIC
+    uint16_t version;           // RECORDING_VERSION
+    uint16_t headerSize;        // Size of the header in bytes
+    uint32_t odrMilliHz;        // Output data rate of the sensor in mHz
+    uint8_t channels;           // Number of values per sample of the recording, a record holds 3 per channel
+    uint8_t levelCount;         // Number of levels, the last one needs a single record for the whole file
+    uint8_t baseShift;          // A record of level 0 covers 2^baseShift samples
+    uint8_t reserved[5];        // 0
+    uint64_t firstSample;       // Index of the first sample of the file since the start of the acquisition
+    uint64_t sampleCount;       // Number of samples covered by the records written, the lost ones included
+    int64_t startMonotonicNs;   // CLOCK_MONOTONIC when the file was opened, as in the header of the recording
+    PyramidLevel levels[PYRAMID_LEVELS]; // The first `levelCount` are used
+} PyramidHeader;
+
+#endif
@@ -0,0 +1,1088 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <math.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "AIS2IH_format.h"
+#include "AIS2IH_codec.h"
+
+/*
+Reader of the binary recordings written by `AIS2IH -o bin` and `AIS2IH -o packed`.
+It prints the header of each recording, then its samples in the CSV layout of `AIS2IH -o csv`,
+so `./AIS2IH_read -q FILE > FILE.csv` gives the same file the CSV output would have.
+A session recording (`AIS2IH -U`) is read in one pass, in the order the samples were read: every line starts with
+the index of the sensor, e.g. "1,x,y,z", and each block is preceded by a comment with its sensor and its read time.
+
+With `-b` and `-e`, only the samples of a time window are printed, in seconds from the start of the file. If the recording
+has an index (`AIS2IH -I`), FILE.idx, the reader looks up the entries around the window with a binary search and seeks
+straight to it, so the time to extract a window does not depend on the length of the recording. This also works for
+the CSV files, whose lines carry no time. Without an index, a binary recording is scanned from its start.
+With `-s`, every sample line starts with the CLOCK_REALTIME time of the sample in seconds since the epoch, taken from
+the time file of the recording, FILE.time: the read time of its batch, minus the estimated period for every sample that
+follows it in the batch. In a CSV file, the batches of the time file also give the index of every line, across gaps.
+With `-g`, the sensors of a session recording are resampled onto one time grid of HZ points per second instead, starting at
+the first sample of the last sensor started. Sample n of a sensor is dated `firstRawNs + n * period` from the start of the
+sensor in the time file, the period being the one the acquisition measured, then every channel is linearly interpolated
+at each point of the grid. Every line holds the CLOCK_REALTIME time of the point, then the values of every sensor, e.g.
+"1704106800.123456789,s0x,s0y,s0z,s1x,s1y,s1z", empty where a sensor lost the samples around the point.
+With `-d`, the samples of a binary recording of one sensor are resampled from the output data rate the acquisition
+measured to the nominal one, so that the recordings of sensors whose oscillators deviate keep in step over days. Point k
+is dated `firstRawNs + k * nominal period` and interpolated linearly between the two samples around it, which costs a
+multiplication and a few additions per value. The lines keep the layout of the samples, with `-s` as well.
+A pyramid (`AIS2IH -P`), FILE.pyr, is printed at the coarsest level that still gives `-n` points over the window, one
+line per record with its first sample, then the minimum, maximum and mean of each axis, empty for a record lost whole
+in a gap. Only these records are read.
+
+Options:
+    -H        Only print the headers
+    -q        Do not print the headers, only the samples
+    -b SEC    Print the samples from SEC seconds after the start of the file on
+    -e SEC    Print the samples up to SEC seconds after the start of the file
+    -n POINTS Number of points wanted from a pyramid over the window (default 1000)
+    -s        Start every sample line with the time of the sample, e.g. "1704106800.123456789,x,y,z"
+    -g HZ     Resample the sensors of a session recording onto one grid of HZ points per second
+    -d        Resample a binary recording of one sensor from its measured output data rate to the nominal one
+Example: ./AIS2IH_read acc_data/20240101_120000_sensor0.bin
+         ./AIS2IH_read -q -b 3600 -e 3660 acc_data/20240101_120000_sensor0.csv
+         ./AIS2IH_read -n 2000 acc_data/20240101_120000_sensor0.bin.pyr
+         ./AIS2IH_read -q acc_data/20240101_120000_session.bin
+         ./AIS2IH_read -q -g 1000 acc_data/20240101_120000_session.bin
+         ./AIS2IH_read -q -d acc_data/20240101_120000_sensor0.bin
+         ./AIS2IH_read -H acc_data/20240101_120000_sensor0.bin acc_data/20240101_120000_sensor1.bin
+*/
+
+#define FIFO_DEPTH 32 // Depth of the FIFO, the largest number of samples of a block of a session recording
+
+int headerOnly = 0; // Only print the headers, see `-H`
+int quiet = 0;      // Do not print the headers, see `-q`
+int windowed = 0;   // Only print the samples between `beginNs` and `endNs`, see `-b` and `-e`
+long long beginNs = 0, endNs = LLONG_MAX; // Time window from the start of the file
+long long points = 1000; // Number of points wanted from a pyramid, see `-n`
+int stamped = 0;         // Print the time of every sample, see `-s`
+double gridHz = 0;       // Points per second of the grid the sensors of a session are resampled onto, 0 to print the blocks, see `-g`
+int driftCorrected = 0;  // Resample a recording from its measured output data rate to the nominal one, see `-d`
+
+// Index of a recording mapped in memory, see AIS2IH_format.h
+typedef struct Index
+{
+    IndexHeader header;
+    const IndexEntry *entries; // Entries in time order
+    size_t count;              // Number of entries
+    void *map;                 // Mapping of the whole index file
+    size_t mapSize;            // Size of the mapping
+} Index;
+
+// Time file of a recording mapped in memory, see AIS2IH_format.h
+typedef struct Times
+{
+    const TimeRecord *records; // Records in the order the batches were written
+    size_t count;              // Number of records
+    const TimeStart *starts;   // Start of each sensor of the recording
+    size_t startCount;         // Number of starts
+    size_t cursor;             // Record of the batch being printed
+    void *map;                 // Mapping of the whole time file
+    size_t mapSize;            // Size of the mapping
+} Times;
+
+// Samples of one sensor of a session waiting to be interpolated onto the grid, see `-g`
+typedef struct GridSensor
+{
+    int used;                  // 1 if the sensor is on the grid, i.e. it was started and has samples
+    int channels;              // Number of values per sample
+    long long firstRawNs;      // CLOCK_MONOTONIC_RAW of sample 0
+    double periodNs;           // Sample period on CLOCK_MONOTONIC_RAW
+    unsigned long long base;   // Index of the first sample held
+    unsigned long long next;   // Index following the last sample held, i.e. the number of samples read so far
+    float *values;             // Values of samples `base` to `next` - 1, NaN for the samples that were lost
+    size_t capacity;           // Number of samples `values` can hold
+} GridSensor;
+
+// Function prototypes
+int readRecording(const char *path);               // Print one recording, return 0 on success
+int readSession(FILE *file, const char *path);     // Print a session recording from its start, return 0 on success
+int resampleSession(FILE *file, const char *path, const RecordingHeader *headers, int sensorCount); // Print a session on one time grid, return 0 on success
+int checkHeader(const RecordingHeader *header);    // Return 0 if the header of a recording is supported
+void printHeader(const RecordingHeader *header);   // Print the header of a recording as comment lines
+void printSample(const short *samples, int channels); // Print one sample in the CSV layout
+void printValues(const double *values, int count); // Print interpolated values in the CSV layout, NaN as empty fields
+int resampleRecording(FILE *file, const char *path, const RecordingHeader *header); // Print a recording at its nominal rate, return 0 on success
+void *mapSidecar(const char *path, const char *suffix, const char *magic, size_t *mapSize, int *found); // Map a file next to a recording
+int openIndex(const char *path, Index *index);     // Map the index of a recording, return 0 on success, 1 if it has none
+void closeIndex(Index *index);                     // Unmap an index
+int openTimes(const char *path, Times *times);     // Map the time file of a recording, return 0 on success
+void seekTimes(Times *times, unsigned long long sample); // Move the cursor of a time file to the batch of a sample
+long long sampleTime(Times *times, unsigned long long sample); // Return the time of a sample, moving the cursor forward, 0 if unknown
+void printTime(long long timeNs);                  // Print the time of a sample at the start of its line
+size_t findEntry(const Index *index, long long timeNs); // Return the last entry of an index at or before a time, or the first one
+unsigned long long sampleAt(const IndexEntry *anchor, long long timeNs, long long periodNs); // Return the first sample at or after a time
+int readCsv(FILE *file, const char *path);         // Print the samples of a CSV file in the time window, return 0 on success
+int readPyramid(FILE *file, const char *path);     // Print the records of a pyramid over the time window, return 0 on success
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "Hqsdb:e:n:g:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            headerOnly = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 's':
+            stamped = 1;
+            break;
+        case 'd':
+            driftCorrected = 1;
+            break;
+        case 'b':
+            beginNs = (long long)(atof(optarg) * 1e9);
+            windowed = 1;
+            break;
+        case 'e':
+            endNs = (long long)(atof(optarg) * 1e9);
+            windowed = 1;
+            break;
+        case 'n':
+            points = atoll(optarg);
+            if (points < 1)
+            {
+                printf("Error! The number of points must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            gridHz = atof(optarg);
+            if (gridHz <= 0)
+            {
+                printf("Error! The grid frequency must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((gridHz > 0 || driftCorrected) && windowed)
+    {
+        printf("Error! The resampling of `-g` and `-d` cannot be combined with a time window!\n");
+        exit(EXIT_FAILURE);
+    }
+    if (optind == argc)
+    {
+        printf("Error! You must pass a recording!\n");
+        exit(EXIT_FAILURE);
+    }
+    int failed = 0;
+    for (int i = optind; i < argc; i++)
+        failed |= readRecording(argv[i]);
+    return failed ? EXIT_FAILURE : 0;
+}
+
+// Function: Print the header of a recording as comment lines
+void printHeader(const RecordingHeader *header)
+{
+    // Format the start time like the file names of the acquisition
+    time_t start = header->startRealtimeNs / 1000000000LL;
+    char formattedTime[32];
+    strftime(formattedTime, sizeof(formattedTime), "%Y-%m-%d %H:%M:%S", localtime(&start));
+    char axes[4] = "";
+    for (int axis = 0, n = 0; axis < 3; axis++)
+    {
+        if (header->axes & (1 << axis))
+            axes[n++] = 'x' + axis;
+    }
+    printf("# sensor %u on %.64s at 0x%02x\n", header->sensorIndex, header->bus, header->address);
+    printf("# %g Hz, %.8s, ±%u g, watermark %u, %s axes at %u bits\n", header->odrMilliHz / 1000.0, header->powerMode,
+           header->fullScale, header->watermark, axes, header->resolution);
+    if (header->codec == CODEC_DELTA_PACK)
+        printf("# compressed with delta, zigzag and bit-packing\n");
+    printf("# started %s.%09lld (monotonic %lld ns)\n", formattedTime, (long long)(header->startRealtimeNs % 1000000000LL),
+           (long long)header->startMonotonicNs);
+    if (header->firstSample > 0)
+        printf("# continues the acquisition at sample %llu\n", (unsigned long long)header->firstSample);
+}
+
+// Function: Print one sample of `channels` values in the CSV layout
+void printSample(const short *samples, int channels)
+{
+    if (channels == 3)
+        printf("%d,%d,%d\n", samples[0], samples[1], samples[2]);
+    else if (channels == 2)
+        printf("%d,%d\n", samples[0], samples[1]);
+    else
+        printf("%d\n", samples[0]);
+}
+
+// Function: Print `count` interpolated values in the CSV layout, an empty field for a value that is NaN
+void printValues(const double *values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!isnan(values[i]))
+            printf("%.2f", values[i]);
+        putchar(i == count - 1 ? '\n' : ',');
+    }
+}
+
+// Function: Return 0 if the header of a recording is supported
+int checkHeader(const RecordingHeader *header)
+{
+    return header->version != RECORDING_VERSION || header->headerSize < sizeof(*header) || header->channels < 1 || header->channels > 3 ||
+           header->codec > CODEC_DELTA_PACK;
+}
+
+// Function: Print one recording, return 0 on success
+int readRecording(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    // A session recording holds the headers and blocks of several sensors
+    RecordingHeader header;
+    if (fread(&header, sizeof(header.magic), 1, file) == 1 &&
+        (memcmp(header.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) == 0 || memcmp(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC)) == 0))
+    {
+        rewind(file);
+        int ret = header.magic[6] == 'S' ? readSession(file, path) : readPyramid(file, path);
+        fclose(file);
+        return ret;
+    }
+    // Check the header, then skip to the first block, whatever fields newer versions appended
+    rewind(file);
+    if (gridHz > 0)
+    {
+        printf("Error! %s is not a session recording, only a session can be resampled onto a grid!\n", path);
+        fclose(file);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0)
+    {
+        // A window of a CSV file is found through its index, and its lines are dated through its time file
+        if (windowed || stamped)
+        {
+            int ret = readCsv(file, path);
+            fclose(file);
+            return ret;
+        }
+        printf("Error! %s is not an AIS2IH recording!\n", path);
+        fclose(file);
+        return 1;
+    }
+    if (checkHeader(&header) != 0)
+    {
+        printf("Error! %s has an unsupported version %u!\n", path, header.version);
+        fclose(file);
+        return 1;
+    }
+    fseek(file, header.headerSize, SEEK_SET);
+    if (!quiet)
+        printHeader(&header);
+    if (headerOnly)
+    {
+        fclose(file);
+        return 0;
+    }
+    if (driftCorrected)
+    {
+        int ret = resampleRecording(file, path, &header);
+        fclose(file);
+        return ret;
+    }
+    // Turn the time window into a range of samples, and start from the index entry preceding it, or from the first block
+    unsigned long long first = 0, last = ULLONG_MAX, total = header.firstSample;
+    if (windowed && header.odrMilliHz > 0)
+    {
+        long long periodNs = 1000000000000LL / header.odrMilliHz;
+        IndexEntry anchor = {.timestampNs = header.startMonotonicNs - header.firstSample * periodNs, .firstSample = 0};
+        Index index;
+        int found = openIndex(path, &index);
+        if (found < 0)
+        {
+            fclose(file);
+            return 1;
+        }
+        if (found == 0 && index.count > 0)
+        {
+            anchor = index.entries[findEntry(&index, header.startMonotonicNs + beginNs)];
+            fseek(file, anchor.offset, SEEK_SET);
+            total = anchor.firstSample;
+            first = sampleAt(&anchor, header.startMonotonicNs + beginNs, periodNs);
+            if (endNs != LLONG_MAX)
+                last = sampleAt(&index.entries[findEntry(&index, header.startMonotonicNs + endNs)], header.startMonotonicNs + endNs, periodNs);
+        }
+        else
+        {
+            first = sampleAt(&anchor, header.startMonotonicNs + beginNs, periodNs);
+            if (endNs != LLONG_MAX)
+                last = sampleAt(&anchor, header.startMonotonicNs + endNs, periodNs);
+        }
+        if (found == 0)
+            closeIndex(&index);
+        if (!quiet)
+            printf("# samples %llu to %llu\n", first, last == ULLONG_MAX ? last : last - 1);
+    }
+    Times times;
+    if (stamped)
+    {
+        if (openTimes(path, &times) != 0)
+        {
+            fclose(file);
+            return 1;
+        }
+        seekTimes(&times, total > first ? total : first);
+    }
+    // Print the blocks in the CSV layout
+    BlockHeader block;
+    unsigned char payload[CODEC_FRAME * 3 * 3]; // Larger than codecBound(CODEC_FRAME, 3)
+    short frame[CODEC_FRAME * 3];
+    int ret = 0;
+    while (fread(&block, sizeof(block), 1, file) == 1 && block.firstSample < last)
+    {
+        if (block.sampleCount == 0)
+        {
+            // A gap record, the samples it stands for are not in the file
+            if (block.firstSample >= first && !quiet)
+                printf("# %u samples lost from sample %llu\n", block.payloadSize, (unsigned long long)block.firstSample);
+            total = block.firstSample + block.payloadSize;
+            continue;
+        }
+        if (block.firstSample != total && block.firstSample > first && !quiet)
+            printf("# %llu samples missing before sample %llu\n", (unsigned long long)block.firstSample - total,
+                   (unsigned long long)block.firstSample);
+        total = block.firstSample;
+        if (header.codec == CODEC_DELTA_PACK)
+        {
+            // Decode the whole block, then print it like the raw samples
+            if (block.sampleCount < 1 || block.sampleCount > CODEC_FRAME || block.payloadSize > sizeof(payload) ||
+                fread(payload, 1, block.payloadSize, file) != block.payloadSize ||
+                codecDecode(payload, block.payloadSize, frame, block.sampleCount, header.channels) < 0)
+            {
+                printf("Error! %s is damaged after %llu samples!\n", path, total);
+                ret = 1;
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < block.sampleCount; i++)
+        {
+            // The raw samples are read one at a time
+            const short *samples = header.codec == CODEC_RAW ? frame : frame + i * header.channels;
+            if (header.codec == CODEC_RAW && fread(frame, sizeof(frame[0]), header.channels, file) != header.channels)
+            {
+                printf("Error! %s is truncated after %llu samples!\n", path, total);
+                ret = 1;
+                break;
+            }
+            if (total >= first && total < last)
+            {
+                if (stamped)
+                    printTime(sampleTime(&times, total));
+                printSample(samples, header.channels);
+            }
+            total++;
+        }
+        if (ret != 0)
+            break;
+    }
+    if (stamped)
+        munmap(times.map, times.mapSize);
+    fclose(file);
+    return ret;
+}
+
+// Function: Print the samples of a recording resampled from the output data rate measured by the acquisition to the
+// nominal one, return 0 on success. The file is at its first block.
+int resampleRecording(FILE *file, const char *path, const RecordingHeader *header)
+{
+    Times times;
+    if (openTimes(path, &times) != 0)
+        return 1;
+    if (times.startCount != 1 || times.starts[0].firstRawNs == 0 || header->odrMilliHz == 0)
+    {
+        printf("Error! The time file of %s does not record the start of the sensor!\n", path);
+        munmap(times.map, times.mapSize);
+        return 1;
+    }
+    // The period measured until the file was closed, or the last estimate of a file that was not
+    TimeStart start = times.starts[0];
+    double measuredNs = start.periodFs > 0 ? start.periodFs / 1e6 : times.count > 0 ? times.records[times.count - 1].periodNs : 0;
+    munmap(times.map, times.mapSize);
+    double nominalNs = 1e12 / header->odrMilliHz;
+    if (measuredNs <= 0)
+    {
+        printf("Error! %s has no measured period!\n", path);
+        return 1;
+    }
+    // Point k of the output is at `k * nominalNs` after the first sample of the sensor, i.e. at sample `k * ratio`. The points
+    // of a file of a rotated acquisition continue those of the previous file.
+    double ratio = nominalNs / measuredNs;
+    unsigned long long point = (unsigned long long)(header->firstSample / ratio);
+    while (point * ratio < header->firstSample)
+        point++;
+    if (!quiet)
+        printf("# resampled from the measured %.6f Hz to %g Hz\n", 1e9 / measuredNs, header->odrMilliHz / 1000.0);
+    // Every point between two consecutive samples is interpolated between them, the points around a gap are left empty
+    BlockHeader block;
+    unsigned char payload[CODEC_FRAME * 3 * 3]; // Larger than codecBound(CODEC_FRAME, 3)
+    short frame[CODEC_FRAME * 3];
+    short previous[3];
+    double values[3];
+    unsigned long long total = header->firstSample;
+    int held = 0, ret = 0;
+    while (ret == 0 && fread(&block, sizeof(block), 1, file) == 1)
+    {
+        if (block.sampleCount == 0)
+            continue;
+        size_t length = header->codec == CODEC_RAW ? block.sampleCount * header->channels * sizeof(short) : block.payloadSize;
+        if (block.sampleCount < 1 || block.sampleCount > CODEC_FRAME || length > sizeof(payload) ||
+            fread(header->codec == CODEC_RAW ? (void *)frame : (void *)payload, 1, length, file) != length ||
+            (header->codec == CODEC_DELTA_PACK && codecDecode(payload, length, frame, block.sampleCount, header->channels) < 0))
+        {
+            printf("Error! %s is damaged or truncated after %llu samples!\n", path, total);
+            ret = 1;
+            break;
+        }
+        if (block.firstSample != total)
+            held = 0;
+        for (uint32_t i = 0; i < block.sampleCount; i++)
+        {
+            const short *current = frame + i * header->channels;
+            unsigned long long sample = block.firstSample + i;
+            for (; point * ratio < sample; point++)
+            {
+                double fraction = point * ratio - (sample - 1);
+                for (int v = 0; v < header->channels; v++)
+                    values[v] = held ? previous[v] + (current[v] - previous[v]) * fraction : NAN;
+                if (stamped)
+                    printTime((long long)(start.firstRealtimeNs + point * nominalNs + 0.5));
+                printValues(values, header->channels);
+            }
+            memcpy(previous, current, header->channels * sizeof(short));
+            held = 1;
+        }
+        total = block.firstSample + block.sampleCount;
+    }
+    return ret;
+}
+
+// Function: Print a session recording from its start, the blocks of all sensors in the order they were written, return 0 on success
+int readSession(FILE *file, const char *path)
+{
+    SessionHeader session;
+    if (fread(&session, sizeof(session), 1, file) != 1 || session.version != RECORDING_VERSION || session.headerSize < sizeof(session) ||
+        session.sensorCount == 0)
+    {
+        printf("Error! %s has an unsupported version %u!\n", path, session.version);
+        return 1;
+    }
+    // Read the header of every sensor, each one may be longer than the RecordingHeader known here
+    RecordingHeader *headers = calloc(session.sensorCount, sizeof(RecordingHeader));
+    unsigned long long *totals = calloc(session.sensorCount, sizeof(unsigned long long));
+    if (headers == NULL || totals == NULL)
+    {
+        perror("Failed to allocate the sensor headers");
+        exit(EXIT_FAILURE);
+    }
+    long offset = session.headerSize;
+    int ret = 0;
+    for (int i = 0; i < session.sensorCount && ret == 0; i++)
+    {
+        fseek(file, offset, SEEK_SET);
+        if (fread(&headers[i], sizeof(headers[i]), 1, file) != 1 || memcmp(headers[i].magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 ||
+            checkHeader(&headers[i]) != 0)
+        {
+            printf("Error! %s has an unsupported header for sensor %d!\n", path, i);
+            ret = 1;
+        }
+        offset += headers[i].headerSize;
+        totals[i] = headers[i].firstSample;
+    }
+    fseek(file, offset, SEEK_SET);
+    if (driftCorrected && ret == 0)
+    {
+        printf("Error! %s is a session recording, resample it onto a grid with `-g`!\n", path);
+        ret = 1;
+    }
+    if (gridHz > 0 && ret == 0 && !headerOnly)
+    {
+        ret = resampleSession(file, path, headers, session.sensorCount);
+        free(headers);
+        free(totals);
+        return ret;
+    }
+    if (!quiet && ret == 0)
+    {
+        printf("# session of %u sensors, lines are \"sensor,x,y,z\"\n", session.sensorCount);
+        for (int i = 0; i < session.sensorCount; i++)
+            printHeader(&headers[i]);
+    }
+    // The blocks are in time order: start from the index entry preceding the window, and stop once a block cannot hold
+    // a sample of the window any more, even from the slowest sensor
+    long long begin = session.startMonotonicNs + beginNs, end = endNs == LLONG_MAX ? LLONG_MAX : session.startMonotonicNs + endNs;
+    long long spanNs = 0;
+    for (int i = 0; i < session.sensorCount && ret == 0; i++)
+    {
+        if (headers[i].odrMilliHz > 0 && FIFO_DEPTH * 1000000000000LL / headers[i].odrMilliHz > spanNs)
+            spanNs = FIFO_DEPTH * 1000000000000LL / headers[i].odrMilliHz;
+    }
+    // The blocks and the records of the time file are in the same order, an index entry gives the number of blocks before it
+    Times times = {.map = NULL};
+    if (stamped && ret == 0 && !headerOnly && openTimes(path, &times) != 0)
+        ret = 1;
+    Index index;
+    int found = windowed && ret == 0 && !headerOnly ? openIndex(path, &index) : 1;
+    if (found < 0)
+        ret = 1;
+    if (found == 0)
+    {
+        if (index.count > 0)
+        {
+            // The samples before the entry are unknown, so are the gaps before the first block of each sensor
+            const IndexEntry *entry = &index.entries[findEntry(&index, begin)];
+            fseek(file, entry->offset, SEEK_SET);
+            times.cursor = entry->firstSample;
+            for (int i = 0; i < session.sensorCount; i++)
+                totals[i] = ULLONG_MAX;
+        }
+        closeIndex(&index);
+    }
+    // Stream the blocks in file order, which is the order they were read in
+    SessionBlockHeader block;
+    unsigned char payload[CODEC_FRAME * 3 * 3]; // Larger than codecBound(CODEC_FRAME, 3)
+    short frame[CODEC_FRAME * 3];
+    unsigned long long blocks = 0;
+    while (ret == 0 && !headerOnly && fread(&block, sizeof(block), 1, file) == 1 && (end == LLONG_MAX || block.timestampNs - spanNs < end))
+    {
+        const RecordingHeader *header = &headers[block.sensor < session.sensorCount ? block.sensor : 0];
+        if (block.block.sampleCount == 0 && block.sensor < session.sensorCount)
+        {
+            // A gap record, it has no record in the time file
+            if (!quiet && (!windowed || (block.timestampNs >= begin && block.timestampNs - spanNs < end)))
+                printf("# sensor %u: %u samples lost from sample %llu\n", block.sensor, block.block.payloadSize,
+                       (unsigned long long)block.block.firstSample);
+            totals[block.sensor] = block.block.firstSample + block.block.payloadSize;
+            continue;
+        }
+        size_t length = header->codec == CODEC_RAW ? block.block.sampleCount * header->channels * sizeof(short) : block.block.payloadSize;
+        if (block.sensor >= session.sensorCount || block.block.sampleCount < 1 || block.block.sampleCount > CODEC_FRAME || length > sizeof(payload))
+        {
+            printf("Error! %s is damaged after %llu blocks!\n", path, blocks);
+            ret = 1;
+            break;
+        }
+        if (fread(header->codec == CODEC_RAW ? (void *)frame : (void *)payload, 1, length, file) != length ||
+            (header->codec == CODEC_DELTA_PACK && codecDecode(payload, length, frame, block.block.sampleCount, header->channels) < 0))
+        {
+            printf("Error! %s is truncated after %llu samples of sensor %u!\n", path, totals[block.sensor], block.sensor);
+            ret = 1;
+            break;
+        }
+        // Date the samples back from the read time of the block
+        long long periodNs = header->odrMilliHz > 0 ? 1000000000000LL / header->odrMilliHz : 0;
+        long long firstNs = block.timestampNs - (block.block.sampleCount - 1) * periodNs;
+        int inWindow = !windowed || (block.timestampNs >= begin && firstNs < end);
+        if (!quiet && inWindow)
+        {
+            if (block.block.firstSample != totals[block.sensor] && totals[block.sensor] != ULLONG_MAX)
+                printf("# sensor %u: %llu samples missing before sample %llu\n", block.sensor,
+                       (unsigned long long)block.block.firstSample - totals[block.sensor], (unsigned long long)block.block.firstSample);
+            long long elapsed = block.timestampNs - session.startMonotonicNs;
+            printf("# sensor %u, %u samples read at %lld.%09lld s\n", block.sensor, block.block.sampleCount, elapsed / 1000000000LL,
+                   elapsed % 1000000000LL);
+        }
+        totals[block.sensor] = block.block.firstSample + block.block.sampleCount;
+        blocks++;
+        const TimeRecord *record = NULL;
+        if (stamped && times.cursor < times.count)
+        {
+            record = &times.records[times.cursor++];
+            if (record->sensor != block.sensor || record->firstSample != block.block.firstSample)
+                record = NULL;
+        }
+        for (uint32_t i = 0; i < block.block.sampleCount && inWindow; i++)
+        {
+            long long sampleNs = firstNs + i * periodNs;
+            if (windowed && (sampleNs < begin || sampleNs >= end))
+                continue;
+            if (stamped)
+                printTime(record == NULL ? 0 : record->realtimeNs - (long long)(block.block.sampleCount - 1 - i) * record->periodNs);
+            printf("%u,", block.sensor);
+            printSample(frame + i * header->channels, header->channels);
+        }
+    }
+    if (times.map != NULL)
+        munmap(times.map, times.mapSize);
+    free(headers);
+    free(totals);
+    return ret;
+}
+
+// Function: Resample the sensors of a session recording onto one time grid of `gridHz` points per second, from the start of
+// every sensor and its period measured over the whole recording, return 0 on success. The file is at the first block.
+int resampleSession(FILE *file, const char *path, const RecordingHeader *headers, int sensorCount)
+{
+    Times times;
+    if (openTimes(path, &times) != 0)
+        return 1;
+    if (times.startCount != (size_t)sensorCount)
+    {
+        printf("Error! The time file of %s does not record the start of the sensors!\n", path);
+        munmap(times.map, times.mapSize);
+        return 1;
+    }
+    GridSensor *grid = calloc(sensorCount, sizeof(GridSensor));
+    if (grid == NULL)
+    {
+        perror("Failed to allocate the grid");
+        exit(EXIT_FAILURE);
+    }
+    // The period of a sensor is the one the acquisition measured until the file was closed, or its last estimate in the
+    // time file of a recording that was not closed
+    for (size_t r = 0; r < times.count; r++)
+    {
+        const TimeRecord *record = &times.records[r];
+        if (record->sensor >= sensorCount || times.starts[record->sensor].firstRawNs == 0)
+            continue;
+        grid[record->sensor].used = 1;
+        grid[record->sensor].periodNs = record->periodNs;
+    }
+    for (int i = 0; i < sensorCount; i++)
+    {
+        if (times.starts[i].periodFs > 0)
+            grid[i].periodNs = times.starts[i].periodFs / 1e6;
+    }
+    // The grid starts at the first sample of the sensor started last, so that every sensor has samples around every point
+    long long startNs = 0, offsetNs = 0;
+    int columns = 0;
+    for (int i = 0; i < sensorCount; i++)
+    {
+        if (!grid[i].used)
+            continue;
+        grid[i].channels = headers[i].channels;
+        grid[i].firstRawNs = times.starts[i].firstRawNs;
+        if (columns == 0 || grid[i].firstRawNs > startNs)
+            startNs = grid[i].firstRawNs;
+        if (columns == 0)
+            offsetNs = times.starts[i].firstRealtimeNs - times.starts[i].firstRawNs;
+        columns += grid[i].channels;
+    }
+    munmap(times.map, times.mapSize);
+    if (columns == 0)
+    {
+        printf("Error! No sensor of %s was started with samples!\n", path);
+        free(grid);
+        return 1;
+    }
+    if (!quiet)
+    {
+        printf("# session of %d sensors on a grid of %g Hz, lines are \"time", sensorCount, gridHz);
+        for (int i = 0; i < sensorCount; i++)
+        {
+            for (int v = 0; v < 3 && grid[i].used; v++)
+            {
+                if (headers[i].axes & (1 << v))
+                    printf(",s%d%c", i, 'x' + v);
+            }
+        }
+        printf("\"\n");
+        for (int i = 0; i < sensorCount; i++)
+        {
+            if (grid[i].used)
+                printf("# sensor %d: first sample at %lld ns, period %.3f ns\n", i, grid[i].firstRawNs, grid[i].periodNs);
+            else
+                printf("# sensor %d: not started or without samples, left out\n", i);
+        }
+    }
+    // Stream the blocks, and print every point of the grid once every sensor has the samples that follow it
+    SessionBlockHeader block;
+    unsigned char payload[CODEC_FRAME * 3 * 3]; // Larger than codecBound(CODEC_FRAME, 3)
+    short frame[CODEC_FRAME * 3];
+    double stepNs = 1e9 / gridHz;
+    int ret = 0, ended = 0;
+    for (unsigned long long point = 0; ret == 0; point++)
+    {
+        double pointNs = point * stepNs; // From `startNs`
+        for (int i = 0; i < sensorCount && ret == 0; i++)
+        {
+            GridSensor *sensor = &grid[i];
+            if (!sensor->used)
+                continue;
+            unsigned long long needed = (unsigned long long)((startNs - sensor->firstRawNs + pointNs) / sensor->periodNs) + 1;
+            // Read blocks until this sensor holds the sample after the point
+            while (sensor->next <= needed && !ended)
+            {
+                if (fread(&block, sizeof(block), 1, file) != 1)
+                {
+                    ended = 1;
+                    break;
+                }
+                // The samples of a gap record are skipped like the ones missing between two blocks
+                if (block.block.sampleCount == 0 && block.sensor < sensorCount)
+                    continue;
+                const RecordingHeader *header = &headers[block.sensor < sensorCount ? block.sensor : 0];
+                size_t length = header->codec == CODEC_RAW ? block.block.sampleCount * header->channels * sizeof(short) : block.block.payloadSize;
+                if (block.sensor >= sensorCount || block.block.sampleCount < 1 || block.block.sampleCount > CODEC_FRAME || length > sizeof(payload) ||
+                    fread(header->codec == CODEC_RAW ? (void *)frame : (void *)payload, 1, length, file) != length ||
+                    (header->codec == CODEC_DELTA_PACK && codecDecode(payload, length, frame, block.block.sampleCount, header->channels) < 0))
+                {
+                    printf("Error! %s is damaged or truncated!\n", path);
+                    ret = 1;
+                    break;
+                }
+                GridSensor *owner = &grid[block.sensor];
+                if (!owner->used || block.block.firstSample < owner->next)
+                    continue;
+                // Drop the samples every later point is past, then append the block after the samples lost before it, if any
+                unsigned long long keep = (unsigned long long)((startNs - owner->firstRawNs + pointNs) / owner->periodNs);
+                if (keep > owner->next)
+                    keep = owner->next;
+                if (keep > owner->base)
+                {
+                    memmove(owner->values, owner->values + (keep - owner->base) * owner->channels,
+                            (owner->next - keep) * owner->channels * sizeof(float));
+                    owner->base = keep;
+                }
+                size_t held = block.block.firstSample + block.block.sampleCount - owner->base;
+                if (held > owner->capacity)
+                {
+                    owner->capacity = held * 2;
+                    owner->values = realloc(owner->values, owner->capacity * owner->channels * sizeof(float));
+                    if (owner->values == NULL)
+                    {
+                        perror("Failed to allocate the samples of the grid");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                for (unsigned long long n = owner->next; n < block.block.firstSample; n++)
+                {
+                    for (int v = 0; v < owner->channels; v++)
+                        owner->values[(n - owner->base) * owner->channels + v] = NAN;
+                }
+                for (uint32_t n = 0; n < block.block.sampleCount; n++)
+                {
+                    for (int v = 0; v < owner->channels; v++)
+                        owner->values[(block.block.firstSample + n - owner->base) * owner->channels + v] = frame[n * owner->channels + v];
+                }
+                owner->next = block.block.firstSample + block.block.sampleCount;
+            }
+            if (sensor->next <= needed)
+                ended = 1;
+        }
+        if (ended || ret != 0)
+            break;
+        printTime((long long)(startNs + offsetNs + pointNs + 0.5));
+        double row[columns];
+        int column = 0;
+        for (int i = 0; i < sensorCount; i++)
+        {
+            GridSensor *sensor = &grid[i];
+            if (!sensor->used)
+                continue;
+            double position = (startNs - sensor->firstRawNs + pointNs) / sensor->periodNs;
+            unsigned long long n = (unsigned long long)position;
+            double fraction = position - n;
+            // The samples before `base` were dropped after the first block was read, the first points then have no sample before them
+            const float *before = n >= sensor->base ? sensor->values + (n - sensor->base) * sensor->channels : NULL;
+            for (int v = 0; v < sensor->channels; v++)
+                row[column++] = before == NULL ? NAN : before[v] + (before[v + sensor->channels] - before[v]) * fraction;
+        }
+        printValues(row, columns);
+    }
+    for (int i = 0; i < sensorCount; i++)
+        free(grid[i].values);
+    free(grid);
+    return ret;
+}
+
+// Function: Map the file FILE`suffix` next to a recording, and check that it starts with `magic`, the version and the
+// size of its header, as all of them do. Return the mapping, or NULL with `found` set to 1 if the file does not exist, -1
+// if it is damaged
+void *mapSidecar(const char *path, const char *suffix, const char *magic, size_t *mapSize, int *found)
+{
+    char sidecarPath[4096];
+    snprintf(sidecarPath, sizeof(sidecarPath), "%s%s", path, suffix);
+    *found = 1;
+    int fd = open(sidecarPath, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    *found = -1;
+    struct stat status;
+    void *map = MAP_FAILED;
+    // The header is at least the magic, the version and its size, i.e. 12 bytes
+    if (fstat(fd, &status) == 0 && status.st_size >= 12)
+        map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("Error! %s is damaged!\n", sidecarPath);
+        return NULL;
+    }
+    uint16_t version, headerSize;
+    memcpy(&version, (const char *)map + 8, sizeof(version));
+    memcpy(&headerSize, (const char *)map + 10, sizeof(headerSize));
+    if (memcmp(map, magic, 8) != 0 || version != RECORDING_VERSION || headerSize > status.st_size)
+    {
+        printf("Error! %s has an unsupported version %u!\n", sidecarPath, version);
+        munmap(map, status.st_size);
+        return NULL;
+    }
+    *mapSize = status.st_size;
+    *found = 0;
+    return map;
+}
+
+// Function: Map the index of a recording, FILE.idx, return 0 on success, 1 if the recording has no index, -1 if it is damaged
+int openIndex(const char *path, Index *index)
+{
+    int found;
+    index->map = mapSidecar(path, ".idx", INDEX_MAGIC, &index->mapSize, &found);
+    if (found != 0)
+        return found;
+    memcpy(&index->header, index->map, sizeof(index->header));
+    if (index->header.headerSize < sizeof(IndexHeader))
+    {
+        printf("Error! The index of %s is damaged!\n", path);
+        munmap(index->map, index->mapSize);
+        return -1;
+    }
+    // Only the entries, a partial entry at the end of an index that was not closed is ignored
+    index->entries = (const IndexEntry *)((const char *)index->map + index->header.headerSize);
+    index->count = (index->mapSize - index->header.headerSize) / sizeof(IndexEntry);
+    return 0;
+}
+
+// Function: Unmap an index
+void closeIndex(Index *index)
+{
+    munmap(index->map, index->mapSize);
+}
+
+// Function: Return the position of the last entry of an index at or before `timeNs`, or 0 if the time precedes all entries
+size_t findEntry(const Index *index, long long timeNs)
+{
+    size_t low = 0, high = index->count;
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (index->entries[middle].timestampNs <= timeNs)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Function: Return the first sample at or after `timeNs`, counting whole periods from the sample of an index entry
+unsigned long long sampleAt(const IndexEntry *anchor, long long timeNs, long long periodNs)
+{
+    if (timeNs <= anchor->timestampNs)
+        return anchor->firstSample;
+    return anchor->firstSample + (timeNs - anchor->timestampNs + periodNs - 1) / periodNs;
+}
+
+// Function: Print the lines of a CSV file in the time window, found through its index, return 0 on success
+int readCsv(FILE *file, const char *path)
+{
+    Index index;
+    Times times = {.map = NULL};
+    int found = openIndex(path, &index), ret = 0;
+    if (found < 0 || (stamped && openTimes(path, &times) != 0))
+        ret = 1;
+    else if (windowed && (found != 0 || index.count == 0 || index.header.odrMilliHz == 0))
+    {
+        printf("Error! %s is not an AIS2IH recording, or a CSV file without an index!\n", path);
+        ret = 1;
+    }
+    // The lines carry no sample number: count them from the entry preceding the window, or from the start, and take the
+    // first sample of every later batch of the time file, or else of every later index entry, which skips the samples
+    // lost in between
+    unsigned long long sample = 0, first = 0, last = ULLONG_MAX;
+    size_t entry = 0;
+    long offset = 0;
+    if (ret == 0 && windowed)
+    {
+        long long periodNs = 1000000000000LL / index.header.odrMilliHz;
+        long long start = index.header.startMonotonicNs;
+        entry = findEntry(&index, start + beginNs);
+        sample = index.entries[entry].firstSample;
+        offset = index.entries[entry].offset;
+        first = sampleAt(&index.entries[entry], start + beginNs, periodNs);
+        if (endNs != LLONG_MAX)
+            last = sampleAt(&index.entries[findEntry(&index, start + endNs)], start + endNs, periodNs);
+        if (!quiet)
+            printf("# samples %llu to %llu\n", first, last == ULLONG_MAX ? last : last - 1);
+    }
+    else if (times.map != NULL && times.count > 0)
+        sample = times.records[0].firstSample;
+    if (times.map != NULL)
+        seekTimes(&times, sample);
+    fseek(file, offset, SEEK_SET);
+    char line[64];
+    for (; ret == 0 && sample < last && fgets(line, sizeof(line), file) != NULL; offset += strlen(line))
+    {
+        if (times.map != NULL && times.cursor < times.count)
+        {
+            const TimeRecord *record = &times.records[times.cursor];
+            if (times.cursor + 1 < times.count && sample >= record->firstSample + record->sampleCount)
+                sample = times.records[++times.cursor].firstSample;
+        }
+        else
+        {
+            while (found == 0 && entry + 1 < index.count && offset >= (long)index.entries[entry + 1].offset)
+                sample = index.entries[++entry].firstSample;
+        }
+        if (sample >= last)
+            break;
+        if (sample >= first)
+        {
+            if (stamped)
+                printTime(sampleTime(&times, sample));
+            fputs(line, stdout);
+        }
+        sample++;
+    }
+    if (found == 0)
+        closeIndex(&index);
+    if (times.map != NULL)
+        munmap(times.map, times.mapSize);
+    return ret;
+}
+
+// Function: Print the records of a pyramid over the time window, at the coarsest level giving at least `points` records
+int readPyramid(FILE *file, const char *path)
+{
+    PyramidHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.version != RECORDING_VERSION || header.headerSize < sizeof(header) ||
+        header.levelCount < 1 || header.levelCount > PYRAMID_LEVELS || header.channels < 1 || header.channels > 3 || header.odrMilliHz == 0)
+    {
+        printf("Error! %s has an unsupported version %u!\n", path, header.version);
+        return 1;
+    }
+    // Turn the window into samples from the first one of the file
+    long long periodNs = 1000000000000LL / header.odrMilliHz;
+    unsigned long long first = beginNs > 0 ? (beginNs + periodNs - 1) / periodNs : 0, last = header.sampleCount;
+    if (endNs != LLONG_MAX && (unsigned long long)((endNs + periodNs - 1) / periodNs) < last)
+        last = endNs > 0 ? (endNs + periodNs - 1) / periodNs : 0;
+    int level = header.levelCount - 1;
+    unsigned long long start = 0, end = 0;
+    for (; level >= 0; level--)
+    {
+        int shift = header.baseShift + level;
+        start = first >> shift;
+        end = last > first ? ((last - 1) >> shift) + 1 : start;
+        if (end > header.levels[level].count)
+            end = header.levels[level].count;
+        if (end - start >= (unsigned long long)points || level == 0)
+            break;
+    }
+    if (!quiet)
+    {
+        printf("# pyramid of %u levels, %g Hz, %llu samples from sample %llu\n", header.levelCount, header.odrMilliHz / 1000.0,
+               (unsigned long long)header.sampleCount, (unsigned long long)header.firstSample);
+        for (int i = 0; headerOnly && i < header.levelCount; i++)
+            printf("# level %d: %llu records of %llu samples\n", i, (unsigned long long)header.levels[i].count, 1ULL << (header.baseShift + i));
+        if (!headerOnly)
+            printf("# level %d, %llu samples per record, lines are \"sample,%s\"\n", level, 1ULL << (header.baseShift + level),
+                   header.channels == 3 ? "min,max,mean,min,max,mean,min,max,mean" : header.channels == 2 ? "min,max,mean,min,max,mean" : "min,max,mean");
+    }
+    if (headerOnly)
+        return 0;
+    // Read only the records of the window
+    size_t recordSize = 3 * header.channels * sizeof(short);
+    short record[9];
+    fseek(file, header.levels[level].offset + start * recordSize, SEEK_SET);
+    for (unsigned long long i = start; i < end; i++)
+    {
+        if (fread(record, recordSize, 1, file) != 1)
+        {
+            printf("Error! %s is truncated after %llu records of level %d!\n", path, i, level);
+            return 1;
+        }
+        // A record lost whole in a gap is empty, with a minimum above its maximum, and printed with empty fields
+        printf("%llu", (unsigned long long)header.firstSample + (i << (header.baseShift + level)));
+        for (int v = 0; v < 3 * header.channels; v++)
+        {
+            if (record[0] > record[1])
+                printf(",");
+            else
+                printf(",%d", record[v]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+// Function: Map the time file of a recording, FILE.time, return 0 on success
+int openTimes(const char *path, Times *times)
+{
+    int found;
+    times->map = mapSidecar(path, ".time", TIME_MAGIC, &times->mapSize, &found);
+    if (found > 0)
+        printf("Error! %s has no time file!\n", path);
+    if (found != 0)
+        return 1;
+    // The header is followed by the start of each sensor of the file
+    TimeHeader header = {.headerSize = 0};
+    if (times->mapSize >= sizeof(header))
+        memcpy(&header, times->map, sizeof(header));
+    if (header.headerSize < sizeof(header) + header.sensorCount * sizeof(TimeStart))
+    {
+        printf("Error! The time file of %s is damaged!\n", path);
+        munmap(times->map, times->mapSize);
+        return 1;
+    }
+    times->starts = (const TimeStart *)((const char *)times->map + sizeof(header));
+    times->startCount = header.sensorCount;
+    // A partial record at the end of a time file that was not closed is ignored
+    times->records = (const TimeRecord *)((const char *)times->map + header.headerSize);
+    times->count = header.headerSize <= times->mapSize ? (times->mapSize - header.headerSize) / sizeof(TimeRecord) : 0;
+    times->cursor = 0;
+    return 0;
+}
+
+// Function: Move the cursor of the time file of a sensor to the first batch that ends after sample `sample`
+void seekTimes(Times *times, unsigned long long sample)
+{
+    size_t low = 0, high = times->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (times->records[middle].firstSample + times->records[middle].sampleCount <= sample)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    times->cursor = low;
+}
+
+// Function: Return the CLOCK_REALTIME time of sample `sample` of a sensor, dated back from the read time of its batch by
+// the estimated period, 0 if no batch holds it. The cursor only moves forward, so the samples must come in order.
+long long sampleTime(Times *times, unsigned long long sample)
+{
+    while (times->cursor < times->count && sample >= times->records[times->cursor].firstSample + times->records[times->cursor].sampleCount)
+        times->cursor++;
+    if (times->cursor == times->count || sample < times->records[times->cursor].firstSample)
+        return 0;
+    const TimeRecord *record = &times->records[times->cursor];
+    return record->realtimeNs - (long long)(record->firstSample + record->sampleCount - 1 - sample) * record->periodNs;
+}
+
+// Function: Print the time of a sample in seconds since the epoch at the start of its line, an empty field if it is unknown
+void printTime(long long timeNs)
+{
+    if (timeNs <= 0)
+        printf(",");
+    else
+        printf("%lld.%09lld,", timeNs / 1000000000LL, timeNs % 1000000000LL);
+}